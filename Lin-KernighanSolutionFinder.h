@@ -10,59 +10,43 @@ struct TreeNode {
     NodeType mainChild;
     SmallVector<NodeType> otherChildren;
 };
-template<typename T> bool operator==(const SmallVector<T>& a, const SmallVector<T>& b) {
-    if (a.size() != b.size())
-        return false;
-    for (int i = 0; i < a.size(); ++i) {
-        if (a[i] != b[i])
-            return false;
-    }
-    return true;
+/*
+    Fingerprint of a route used to not process the same route twice.
+    Every node is hashed separately with its parent and main child (which fully describe the route)
+    and combined with xor (Zobrist style), so that a move only needs to xor out old and xor in new
+    fingerprints of the nodes it relinked instead of hashing the whole route again.
+*/
+uint64_t nodeFingerprint(const VectorPoolAlloc<TreeNode>& nodes, NodeType node) {
+    uint64_t x = (uint64_t(node) << 16) | (uint64_t(nodes[node].parent) << 8) | nodes[node].mainChild;
+    x += 0x9e3779b97f4a7c15ull;
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27; x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
 }
-bool operator==(const TreeNode& a, const TreeNode& b) {
-    if ((a.parent != b.parent) || (a.isOnMainPath != b.isOnMainPath) || (a.mainChild != b.mainChild) || (a.otherChildren.size() != b.otherChildren.size()))
-        return false;
-    if (a.otherChildren.size() == 0)
-        return true;
-    if (a.otherChildren.size() == 1 && a.otherChildren[0] == b.otherChildren[0])
-        return true;
-    auto aOtherChildren = a.otherChildren;
-    auto bOtherChildren = b.otherChildren;
-    std::sort(aOtherChildren.begin(), aOtherChildren.end());
-    std::sort(bOtherChildren.begin(), bOtherChildren.end());
-    return aOtherChildren == bOtherChildren;
-}
-template<typename T> bool operator==(const VectorPoolAlloc<T>& a, const VectorPoolAlloc<T>& b) {
-    if (a.size() != b.size())
-        return false;
-    for (int i = 0; i < a.size(); ++i) {
-        if (!(a[i] == b[i]))
-            return false;
+uint64_t nodesFingerprint(const VectorPoolAlloc<TreeNode>& nodes, std::initializer_list<NodeType> nodeList) {
+    uint64_t hash = 0;
+    for (auto it = nodeList.begin(); it != nodeList.end(); ++it) {
+        if (*it != NullNode && std::find(nodeList.begin(), it, *it) == it)
+            hash ^= nodeFingerprint(nodes, *it);
     }
-    return true;
+    return hash;
 }
-
-namespace std {
-    template <> struct hash<VectorPoolAlloc<TreeNode>> {
-        std::size_t operator()(const VectorPoolAlloc<TreeNode>& k) const {
-            uint64_t hash = 5381;
-            for (int i = 0; i < k.size(); ++i) {
-                hash = hash * 33 + k[i].parent;
-                hash = hash * 33 + k[i].mainChild;
-            }
-            return hash;
-        }
-    };
+uint64_t tourFingerprint(const VectorPoolAlloc<TreeNode>& nodes) {
+    uint64_t hash = 0;
+    for (int i = 0; i < nodes.size(); ++i)
+        hash ^= nodeFingerprint(nodes, i);
+    return hash;
 }
 
 void saveSolution(SolutionConfig& config, VectorPoolAlloc<TreeNode>& nodes) {
-    std::vector<std::vector<CompressedEdge>> allSolutions(1);
+    std::vector<NodeType> mainPath = { 0 };
+    std::vector<std::vector<std::vector<CompressedEdge>>> subTrees;
     NodeType cur = 0;
     while (cur != nodes.size() - 1) {
         auto mainPathNext = nodes[cur].mainChild;
-        std::vector<std::vector<CompressedEdge>> subTrees;
+        auto& nodeSubTrees = subTrees.emplace_back();
         for (auto next : nodes[cur].otherChildren) {
-            auto& subTree = subTrees.emplace_back();
+            auto& subTree = nodeSubTrees.emplace_back();
             auto subTreeSrc = cur;
             auto subTreeDst = next;
             while (subTreeDst != NullNode) {
@@ -71,39 +55,59 @@ void saveSolution(SolutionConfig& config, VectorPoolAlloc<TreeNode>& nodes) {
                 subTreeDst = nodes[subTreeSrc].mainChild;
             }
         };
-        if (subTrees.size() == 1) {
-            for (auto& solution : allSolutions) {
-                solution.insert(solution.end(), subTrees[0].begin(), subTrees[0].end());
-            }
-        } else if (subTrees.size() >= 2) {
-            std::vector<std::vector<CompressedEdge>> newAllSolutions;
-            for (int i = 0; i < subTrees.size(); ++i) {
-                auto allSolutionsCopy = allSolutions;
-                for (auto& solution : allSolutionsCopy) {
-                    solution.insert(solution.end(), subTrees[i].begin(), subTrees[i].end());
-                    for (int j = 0; j < subTrees.size(); ++j) {
-                        if (i == j)
-                            continue;
-                        solution.insert(solution.end(), subTrees[j].begin(), subTrees[j].end());
-                    }
-                }
-                newAllSolutions.insert(newAllSolutions.end(), allSolutionsCopy.begin(), allSolutionsCopy.end());
-            }
-            allSolutions = std::move(newAllSolutions);
-        }
-        for (auto& solution : allSolutions)
-            solution.push_back(CompressedEdge{ 0, cur, mainPathNext });
+        mainPath.push_back(mainPathNext);
         cur = mainPathNext;
     }
-    for (auto& solution : allSolutions) {
-        saveSolution(config, solution);
-    }
+    saveSolutionsWithSubTreeOrders(config, mainPath, subTrees);
 }
 
-std::pair<EdgeCostType, NodeType> calculateBranchingSubPathEdgeCosts(SolutionConfig& config, const VectorPoolAlloc<TreeNode>& nodes, NodeType cur, NodeType prev) {
+/*
+    Per worker cache of branching costs for every (node, prev) pair.
+    Branching costs of a node only depend on its otherChildren, so entries of a node are valid as long as
+    its otherChildren are the same as when they were computed. When they differ all entries of that node
+    are invalidated at once by bumping its generation.
+*/
+struct BranchCostCache {
+    static inline thread_local BranchCostCache* current = nullptr;
+
+    BranchCostCache(int nodeCount) : prevCount(nodeCount + 1), children(nodeCount), generations(nodeCount, 1), entries(nodeCount * prevCount) {
+        current = this;
+    }
+    ~BranchCostCache() {
+        current = nullptr;
+    }
+    BranchCostCache(const BranchCostCache&) = delete;
+    BranchCostCache& operator=(const BranchCostCache&) = delete;
+
+    template<typename F> std::pair<EdgeCostType, NodeType> get(const SmallVector<NodeType>& otherChildren, NodeType cur, NodeType prev, F calculate) {
+        if (prev >= prevCount)
+            return calculate();
+        auto& curChildren = children[cur];
+        if (curChildren.size() != otherChildren.size() || !std::equal(curChildren.begin(), curChildren.end(), otherChildren.begin())) {
+            curChildren.assign(otherChildren.begin(), otherChildren.end());
+            generations[cur] += 1;
+        }
+        auto& entry = entries[cur * prevCount + prev];
+        if (entry.generation != generations[cur]) {
+            entry.value = calculate();
+            entry.generation = generations[cur];
+        }
+        return entry.value;
+    }
+
+private:
+    struct Entry {
+        std::pair<EdgeCostType, NodeType> value;
+        uint32_t generation = 0;
+    };
+    int prevCount;
+    std::vector<std::vector<NodeType>> children;
+    std::vector<uint32_t> generations;
+    std::vector<Entry> entries;
+};
+
+std::pair<EdgeCostType, NodeType> calculateBranchingSubPathEdgeCostsUncached(SolutionConfig& config, const VectorPoolAlloc<TreeNode>& nodes, NodeType cur, NodeType prev) {
     thread_local FixedStackVector<std::pair<EdgeCostType, NodeType>> nonRespawnDiff;
-    if (nodes[cur].otherChildren.empty())
-        return { 0, NullNode };
     nonRespawnDiff.clear();
     EdgeCostType respawnCostSum = 0;
     for (auto child : nodes[cur].otherChildren) {
@@ -114,6 +118,14 @@ std::pair<EdgeCostType, NodeType> calculateBranchingSubPathEdgeCosts(SolutionCon
     auto minDiff = *std::min_element(nonRespawnDiff.begin(), nonRespawnDiff.end(), [](auto& a, auto& b) { return a.first < b.first; });
     return { respawnCostSum + minDiff.first, minDiff.second };
 }
+std::pair<EdgeCostType, NodeType> calculateBranchingSubPathEdgeCosts(SolutionConfig& config, const VectorPoolAlloc<TreeNode>& nodes, NodeType cur, NodeType prev) {
+    if (nodes[cur].otherChildren.empty())
+        return { 0, NullNode };
+    auto calculate = [&]() { return calculateBranchingSubPathEdgeCostsUncached(config, nodes, cur, prev); };
+    if (BranchCostCache::current)
+        return BranchCostCache::current->get(nodes[cur].otherChildren, cur, prev, calculate);
+    return calculate();
+}
 EdgeCostType calculateDifferentOutCostsWithNewPrevNode(SolutionConfig& config, const VectorPoolAlloc<TreeNode>& nodes, NodeType cur, NodeType prev) {
     if (nodes[cur].otherChildren.empty())
         return config.condWeights[nodes[cur].mainChild][cur][prev];
@@ -126,366 +138,466 @@ EdgeCostType calculateOutCosts(SolutionConfig& config, const VectorPoolAlloc<Tre
     else
         return config.condWeights.withRespawn(nodes[cur].mainChild, cur) + branchPathCosts;
 }
-bool moveRingCp(SolutionConfig& config, VectorPoolAlloc<TreeNode>& solution, FastThreadSafeishHashSet<VectorPoolAlloc<TreeNode>>& processedSolutions, int ringChainLength, int maxAllowedTimeDiff) {
+/*
+    Moves a chain of ringChainLength ring CPs to a different place in the route (new subtree, start of existing subtree,
+    inside a subtree or on the main path) if that makes the route at most maxAllowedTimeDiff slower.
+    First pass only fills the insertion table with cost of every such move, then moves are applied from the cheapest one
+    until one of them gives a route that wasn't processed yet - applying a move repeats the pass only for its ring chain.
+*/
+bool moveRingCp(SolutionConfig& config, VectorPoolAlloc<TreeNode>& solution, FingerprintSet& processedSolutions, int ringChainLength, int maxAllowedTimeDiff) {
     auto& costEx = config.condWeights;
-    for (NodeType chainStart = 1; chainStart < solution.size() - 1; ++chainStart) {
-        auto node = chainStart;
-        if (config.stopWorking())
-            return false;
-        if (!solution[chainStart].isRingCp)
-            continue;
-        FixedStackVector<NodeType> ringChain;
-        ringChain.emplace_back(chainStart);
-        EdgeCostType costOfRemovingNode = 0;
-        NodeType parent = NullNode;
-        NodeType child = NullNode;
-        int childIndex = -1;
-        if (solution[chainStart].isOnMainPath) {
-            bool couldExtractChain = true;
-            for (int i = 1; i < ringChainLength; ++i) {
-                if (!solution[solution[ringChain.back()].mainChild].isRingCp) {
-                    couldExtractChain = false;
-                    break;
-                }
-                ringChain.emplace_back(solution[ringChain.back()].mainChild);
-            }
-            if (!couldExtractChain)
-                break;
+    thread_local std::vector<uint64_t> nodeFingerprints;
+    nodeFingerprints.resize(solution.size());
+    uint64_t fingerprint = 0;
+    for (NodeType n = 0; n < solution.size(); ++n) {
+        nodeFingerprints[n] = nodeFingerprint(solution, n);
+        fingerprint ^= nodeFingerprints[n];
+    }
+    struct RingCpMove {
+        EdgeCostType cost;
+        NodeType chainStart;
+        int index;
+    };
+    thread_local std::vector<RingCpMove> insertionTable;
+    insertionTable.clear();
+    NodeType applyChainStart = NullNode;
+    int applyIndex = -1;
 
-            parent = solution[chainStart].parent;
-            child = solution[ringChain.back()].mainChild;
-            if (solution[parent].otherChildren.empty()) {
-                costOfRemovingNode += costEx[child][parent][solution[parent].parent];
-                costOfRemovingNode -= costEx[chainStart][parent][solution[parent].parent];
-            } else {
-                costOfRemovingNode += costEx.withRespawn(child, parent);
-                costOfRemovingNode -= costEx.withRespawn(chainStart, parent);
-            }
-            if (ringChain.size() >= 2) {
-                costOfRemovingNode -= costEx[ringChain[1]][ringChain[0]][parent];
-                costOfRemovingNode -= costEx[child][ringChain.back()][ringChain[ringChain.size() - 2]];
-            } else {
-                costOfRemovingNode -= costEx[child][chainStart][parent];
-            }
-            costOfRemovingNode -= calculateDifferentOutCostsWithNewPrevNode(config, solution, child, ringChain.back());
-            costOfRemovingNode += calculateDifferentOutCostsWithNewPrevNode(config, solution, child, parent);
-            if (costOfRemovingNode > 0)
+    auto scan = [&]() {
+        for (NodeType chainStart = 1; chainStart < solution.size() - 1; ++chainStart) {
+            auto node = chainStart;
+            if (config.stopWorking())
+                return false;
+            if (!solution[chainStart].isRingCp)
                 continue;
-
-            solution[parent].mainChild = child;
-            solution[child].parent = parent;
-        } else if (solution[solution[chainStart].parent].isOnMainPath) {
-            parent = solution[chainStart].parent;
-            costOfRemovingNode -= calculateOutCosts(config, solution, parent);
-            for (int i = 0; i < solution[parent].otherChildren.size(); ++i) {
-                if (chainStart == solution[parent].otherChildren[i]) {
-                    childIndex = i;
+            if (applyChainStart != NullNode && chainStart != applyChainStart)
+                continue;
+            int moveIndex = 0;
+            /* returns true if the move should be applied now */
+            auto considerMove = [&](EdgeCostType cost) {
+                int index = moveIndex++;
+                if (cost > maxAllowedTimeDiff)
+                    return false;
+                if (applyChainStart == NullNode) {
+                    insertionTable.push_back(RingCpMove{ cost, chainStart, index });
+                    return false;
+                }
+                return index == applyIndex;
+            };
+            FixedStackVector<NodeType> ringChain;
+            ringChain.emplace_back(chainStart);
+            EdgeCostType costOfRemovingNode = 0;
+            NodeType parent = NullNode;
+            NodeType child = NullNode;
+            int childIndex = -1;
+            if (solution[chainStart].isOnMainPath) {
+                bool couldExtractChain = true;
+                for (int i = 1; i < ringChainLength; ++i) {
+                    if (!solution[solution[ringChain.back()].mainChild].isRingCp) {
+                        couldExtractChain = false;
+                        break;
+                    }
+                    ringChain.emplace_back(solution[ringChain.back()].mainChild);
+                }
+                if (!couldExtractChain)
                     break;
+
+                parent = solution[chainStart].parent;
+                child = solution[ringChain.back()].mainChild;
+                if (solution[parent].otherChildren.empty()) {
+                    costOfRemovingNode += costEx[child][parent][solution[parent].parent];
+                    costOfRemovingNode -= costEx[chainStart][parent][solution[parent].parent];
+                } else {
+                    costOfRemovingNode += costEx.withRespawn(child, parent);
+                    costOfRemovingNode -= costEx.withRespawn(chainStart, parent);
                 }
-            }
-            child = solution[node].mainChild;
-            if (ringChainLength >= 2) {
-                if (child == NullNode)
-                    continue;
-                // TODO: for now I just always extract whole chain
-                while (child != NullNode) {
-                    ringChain.emplace_back(child);
-                    child = solution[child].mainChild;
+                if (ringChain.size() >= 2) {
+                    costOfRemovingNode -= costEx[ringChain[1]][ringChain[0]][parent];
+                    costOfRemovingNode -= costEx[child][ringChain.back()][ringChain[ringChain.size() - 2]];
+                } else {
+                    costOfRemovingNode -= costEx[child][chainStart][parent];
                 }
-                costOfRemovingNode -= costEx[ringChain[1]][ringChain[0]][parent];
-            }
-            if (child == NullNode) {
-                std::swap(solution[parent].otherChildren[childIndex], solution[parent].otherChildren.back());
-                solution[parent].otherChildren.pop_back();
-            } else {
+                costOfRemovingNode -= calculateDifferentOutCostsWithNewPrevNode(config, solution, child, ringChain.back());
+                costOfRemovingNode += calculateDifferentOutCostsWithNewPrevNode(config, solution, child, parent);
+                if (costOfRemovingNode > 0)
+                    continue;
+
+                solution[parent].mainChild = child;
                 solution[child].parent = parent;
-                solution[parent].otherChildren[childIndex] = child;
-            }
-            costOfRemovingNode += calculateOutCosts(config, solution, parent);
-            if (costOfRemovingNode > 0) {
+            } else if (solution[solution[chainStart].parent].isOnMainPath) {
+                parent = solution[chainStart].parent;
+                costOfRemovingNode -= calculateOutCosts(config, solution, parent);
+                for (int i = 0; i < solution[parent].otherChildren.size(); ++i) {
+                    if (chainStart == solution[parent].otherChildren[i]) {
+                        childIndex = i;
+                        break;
+                    }
+                }
+                child = solution[node].mainChild;
+                if (ringChainLength >= 2) {
+                    if (child == NullNode)
+                        continue;
+                    // TODO: for now I just always extract whole chain
+                    while (child != NullNode) {
+                        ringChain.emplace_back(child);
+                        child = solution[child].mainChild;
+                    }
+                    costOfRemovingNode -= costEx[ringChain[1]][ringChain[0]][parent];
+                }
                 if (child == NullNode) {
-                    solution[parent].otherChildren.emplace_back(chainStart);
+                    std::swap(solution[parent].otherChildren[childIndex], solution[parent].otherChildren.back());
+                    solution[parent].otherChildren.pop_back();
                 } else {
-                    solution[child].parent = node;
-                    solution[parent].otherChildren[childIndex] = node;
+                    solution[child].parent = parent;
+                    solution[parent].otherChildren[childIndex] = child;
                 }
-                continue;
-            }
-        } else {
-            parent = solution[node].parent;
-            child = solution[node].mainChild;
-            if (child != NullNode) {
-                costOfRemovingNode -= costEx[child][node][parent];
-                costOfRemovingNode += costEx[child][parent][solution[parent].parent];
-            }
-            costOfRemovingNode -= costEx[node][parent][solution[parent].parent];
-            if (costOfRemovingNode > 0)
-                continue;
-            solution[parent].mainChild = child;
-            if (child != NullNode) {
-                solution[child].parent = parent;
-            }
-        }
-        for (NodeType newParent = 0; newParent < solution.size() - 1; ++newParent) {
-            if (newParent == node || (newParent == parent && !solution[parent].isOnMainPath))
-                continue;
-            if (ringChain.size() >= 2 && std::find(ringChain.begin(), ringChain.end(), newParent) != ringChain.end())
-                continue;
-            EdgeCostType costOfAddingNode = 0;
-            auto tryAddNewSolutionCommon = [&solution, &processedSolutions, &ringChain, newParent](NodeType newChild, bool isOnMainPath) {
-                auto oldParent = solution[ringChain[0]].parent;
-                auto oldChild = solution[ringChain.back()].mainChild;
-                solution[ringChain[0]].parent = newParent;
-                solution[ringChain.back()].mainChild = newChild;
-                auto oldIsOnMainPath = solution[ringChain.back()].isOnMainPath;
-                for (int i = 0; i < ringChain.size(); ++i) {
-                    solution[ringChain[i]].isOnMainPath = isOnMainPath;
+                costOfRemovingNode += calculateOutCosts(config, solution, parent);
+                if (costOfRemovingNode > 0) {
+                    if (child == NullNode) {
+                        solution[parent].otherChildren.emplace_back(chainStart);
+                    } else {
+                        solution[child].parent = node;
+                        solution[parent].otherChildren[childIndex] = node;
+                    }
+                    continue;
                 }
-                if (!processedSolutions.find(solution)) {
-                    processedSolutions.insert(solution);
-                    return true;
+            } else {
+                parent = solution[node].parent;
+                child = solution[node].mainChild;
+                if (child != NullNode) {
+                    costOfRemovingNode -= costEx[child][node][parent];
+                    costOfRemovingNode += costEx[child][parent][solution[parent].parent];
                 }
-                solution[ringChain[0]].parent = oldParent;
-                solution[ringChain.back()].mainChild = oldChild;
-                for (int i = 0; i < ringChain.size(); ++i) {
-                    solution[ringChain[i]].isOnMainPath = oldIsOnMainPath;
+                costOfRemovingNode -= costEx[node][parent][solution[parent].parent];
+                if (costOfRemovingNode > 0)
+                    continue;
+                solution[parent].mainChild = child;
+                if (child != NullNode) {
+                    solution[child].parent = parent;
                 }
-                return false;
-            };
-            auto tryAddNewSolutionNewSubtree = [&tryAddNewSolutionCommon, maxAllowedTimeDiff, &solution, &ringChain, newParent, costOfRemovingNode, &costOfAddingNode]() {
-                if (costOfAddingNode + costOfRemovingNode > maxAllowedTimeDiff)
+            }
+            for (NodeType newParent = 0; newParent < solution.size() - 1; ++newParent) {
+                if (newParent == node || (newParent == parent && !solution[parent].isOnMainPath))
+                    continue;
+                if (ringChain.size() >= 2 && std::find(ringChain.begin(), ringChain.end(), newParent) != ringChain.end())
+                    continue;
+                EdgeCostType costOfAddingNode = 0;
+                auto tryAddNewSolutionCommon = [&solution, &processedSolutions, &ringChain, &fingerprint, parent, child, newParent](NodeType newChild, bool isOnMainPath) {
+                    auto oldParent = solution[ringChain[0]].parent;
+                    auto oldChild = solution[ringChain.back()].mainChild;
+                    solution[ringChain[0]].parent = newParent;
+                    solution[ringChain.back()].mainChild = newChild;
+                    auto oldIsOnMainPath = solution[ringChain.back()].isOnMainPath;
+                    for (int i = 0; i < ringChain.size(); ++i) {
+                        solution[ringChain[i]].isOnMainPath = isOnMainPath;
+                    }
+                    auto changedNodes = { parent, child, ringChain[0], ringChain.back(), newParent, newChild };
+                    auto newFingerprint = fingerprint ^ nodesFingerprint(solution, changedNodes);
+                    for (auto it = changedNodes.begin(); it != changedNodes.end(); ++it) {
+                        if (*it != NullNode && std::find(changedNodes.begin(), it, *it) == it)
+                            newFingerprint ^= nodeFingerprints[*it];
+                    }
+                    if (processedSolutions.insert(newFingerprint))
+                        return true;
+                    solution[ringChain[0]].parent = oldParent;
+                    solution[ringChain.back()].mainChild = oldChild;
+                    for (int i = 0; i < ringChain.size(); ++i) {
+                        solution[ringChain[i]].isOnMainPath = oldIsOnMainPath;
+                    }
                     return false;
-                solution[newParent].otherChildren.emplace_back(ringChain[0]);
-                if (tryAddNewSolutionCommon(NullNode, false))
-                    return true;
-                solution[newParent].otherChildren.pop_back();
-                return false;
-            };
-            auto tryAddNewSolutionPath = [&tryAddNewSolutionCommon, maxAllowedTimeDiff, &solution, &ringChain, newParent, costOfRemovingNode, &costOfAddingNode](NodeType newChild, bool isOnMainPath) {
-                if (costOfAddingNode + costOfRemovingNode > maxAllowedTimeDiff)
+                };
+                auto tryAddNewSolutionNewSubtree = [&tryAddNewSolutionCommon, &considerMove, &solution, &ringChain, newParent, costOfRemovingNode, &costOfAddingNode]() {
+                    if (!considerMove(costOfAddingNode + costOfRemovingNode))
+                        return false;
+                    solution[newParent].otherChildren.emplace_back(ringChain[0]);
+                    if (tryAddNewSolutionCommon(NullNode, false))
+                        return true;
+                    solution[newParent].otherChildren.pop_back();
                     return false;
-                solution[newParent].mainChild = ringChain[0];
-                if (newChild != NullNode)
-                    solution[newChild].parent = ringChain.back();
-                if (tryAddNewSolutionCommon(newChild, isOnMainPath))
-                    return true;
-                solution[newParent].mainChild = newChild;
-                if (newChild != NullNode)
-                    solution[newChild].parent = newParent;
-                return false;
-            };
-            if (!solution[newParent].isOnMainPath) {
-                // adding ring in the middle of a subtree
-                auto newChild = solution[newParent].mainChild;
-                if (ringChain.size() >= 2) {
+                };
+                auto tryAddNewSolutionPath = [&tryAddNewSolutionCommon, &considerMove, &solution, &ringChain, newParent, costOfRemovingNode, &costOfAddingNode](NodeType newChild, bool isOnMainPath) {
+                    if (!considerMove(costOfAddingNode + costOfRemovingNode))
+                        return false;
+                    solution[newParent].mainChild = ringChain[0];
                     if (newChild != NullNode)
-                        continue;
-                    costOfAddingNode += costEx[ringChain[0]][newParent][solution[newParent].parent];
-                    costOfAddingNode += costEx[ringChain[1]][ringChain[0]][newParent];
-                    if (tryAddNewSolutionPath(NullNode, false))
+                        solution[newChild].parent = ringChain.back();
+                    if (tryAddNewSolutionCommon(newChild, isOnMainPath))
                         return true;
-                } else {
-                    if (newChild != NullNode) {
-                        costOfAddingNode -= costEx[newChild][newParent][solution[newParent].parent];
-                        costOfAddingNode += costEx[newChild][node][newParent];
-                    }
-                    costOfAddingNode += costEx[node][newParent][solution[newParent].parent];
-                    if (tryAddNewSolutionPath(newChild, false))
-                        return true;
-                }
-            } else {
-                auto newChild = solution[newParent].mainChild;
-                auto [oldBranchCost, noRespawnNode] = calculateBranchingSubPathEdgeCosts(config, solution, newParent, solution[newParent].parent);
-
-                if (!solution[newParent].isRingCp && solution[newParent].otherChildren.empty()) {
-                    // Adding ring as first subtree
+                    solution[newParent].mainChild = newChild;
+                    if (newChild != NullNode)
+                        solution[newChild].parent = newParent;
+                    return false;
+                };
+                if (!solution[newParent].isOnMainPath) {
+                    // adding ring in the middle of a subtree
+                    auto newChild = solution[newParent].mainChild;
                     if (ringChain.size() >= 2) {
+                        if (newChild != NullNode)
+                            continue;
+                        costOfAddingNode += costEx[ringChain[0]][newParent][solution[newParent].parent];
                         costOfAddingNode += costEx[ringChain[1]][ringChain[0]][newParent];
-                    }
-                    costOfAddingNode += costEx[chainStart][newParent][solution[newParent].parent];
-                    costOfAddingNode += costEx.withRespawn(newChild, newParent);
-                    costOfAddingNode -= costEx[newChild][newParent][solution[newParent].parent];
-                    if (tryAddNewSolutionNewSubtree())
-                        return true;
-                } else if (!solution[newParent].isRingCp) {
-                    if (ringChain.size() >= 2)
-                        continue;
-                    // Adding ring as another subtree
-                    auto costIfNewNoRespawn = costEx[node][newParent][solution[newParent].parent] + costEx.withRespawn(noRespawnNode, newParent) - costEx[noRespawnNode][newParent][solution[newParent].parent];
-                    costOfAddingNode += std::min(costEx.withRespawn(node, newParent), costIfNewNoRespawn);
-                    if (tryAddNewSolutionNewSubtree())
-                        return true;
-                    
-                    // Adding ring at the start of existing subtree
-                    for (int i = 0; i < solution[newParent].otherChildren.size(); ++i) {
-                        auto newChild = solution[newParent].otherChildren[i];
-                        costOfAddingNode = 0;
-                        // TODO: sometimes undervalues
-                        if (newChild == noRespawnNode) {
+                        if (tryAddNewSolutionPath(NullNode, false))
+                            return true;
+                    } else {
+                        if (newChild != NullNode) {
                             costOfAddingNode -= costEx[newChild][newParent][solution[newParent].parent];
-                            costOfAddingNode += costEx[node][newParent][solution[newParent].parent];
-                        } else {
-                            costOfAddingNode -= costEx.withRespawn(newChild, newParent); 
-                            costOfAddingNode += costEx.withRespawn(node, newParent);
+                            costOfAddingNode += costEx[newChild][node][newParent];
                         }
-                        costOfAddingNode += costEx[newChild][node][newParent];
-                        if (solution[newChild].mainChild != NullNode) {
-                            costOfAddingNode -= costEx[solution[newChild].mainChild][newChild][newParent];
-                            costOfAddingNode += costEx[solution[newChild].mainChild][newChild][node];
+                        costOfAddingNode += costEx[node][newParent][solution[newParent].parent];
+                        if (tryAddNewSolutionPath(newChild, false))
+                            return true;
+                    }
+                } else {
+                    auto newChild = solution[newParent].mainChild;
+                    auto [oldBranchCost, noRespawnNode] = calculateBranchingSubPathEdgeCosts(config, solution, newParent, solution[newParent].parent);
+
+                    if (!solution[newParent].isRingCp && solution[newParent].otherChildren.empty()) {
+                        // Adding ring as first subtree
+                        if (ringChain.size() >= 2) {
+                            costOfAddingNode += costEx[ringChain[1]][ringChain[0]][newParent];
                         }
-                        if (costOfAddingNode + costOfRemovingNode <= maxAllowedTimeDiff) {
-                            solution[newParent].otherChildren[i] = node;
-                            solution[newChild].parent = node;
-                            if (tryAddNewSolutionCommon(newChild, false))
-                                return true;
-                            solution[newParent].otherChildren[i] = newChild;
-                            solution[newChild].parent = newParent;
+                        costOfAddingNode += costEx[chainStart][newParent][solution[newParent].parent];
+                        costOfAddingNode += costEx.withRespawn(newChild, newParent);
+                        costOfAddingNode -= costEx[newChild][newParent][solution[newParent].parent];
+                        if (tryAddNewSolutionNewSubtree())
+                            return true;
+                    } else if (!solution[newParent].isRingCp) {
+                        if (ringChain.size() >= 2)
+                            continue;
+                        // Adding ring as another subtree
+                        auto costIfNewNoRespawn = costEx[node][newParent][solution[newParent].parent] + costEx.withRespawn(noRespawnNode, newParent) - costEx[noRespawnNode][newParent][solution[newParent].parent];
+                        costOfAddingNode += std::min(costEx.withRespawn(node, newParent), costIfNewNoRespawn);
+                        if (tryAddNewSolutionNewSubtree())
+                            return true;
+                    
+                        // Adding ring at the start of existing subtree
+                        for (int i = 0; i < solution[newParent].otherChildren.size(); ++i) {
+                            auto newChild = solution[newParent].otherChildren[i];
+                            costOfAddingNode = 0;
+                            // TODO: sometimes undervalues
+                            if (newChild == noRespawnNode) {
+                                costOfAddingNode -= costEx[newChild][newParent][solution[newParent].parent];
+                                costOfAddingNode += costEx[node][newParent][solution[newParent].parent];
+                            } else {
+                                costOfAddingNode -= costEx.withRespawn(newChild, newParent); 
+                                costOfAddingNode += costEx.withRespawn(node, newParent);
+                            }
+                            costOfAddingNode += costEx[newChild][node][newParent];
+                            if (solution[newChild].mainChild != NullNode) {
+                                costOfAddingNode -= costEx[solution[newChild].mainChild][newChild][newParent];
+                                costOfAddingNode += costEx[solution[newChild].mainChild][newChild][node];
+                            }
+                            if (considerMove(costOfAddingNode + costOfRemovingNode)) {
+                                solution[newParent].otherChildren[i] = node;
+                                solution[newChild].parent = node;
+                                if (tryAddNewSolutionCommon(newChild, false))
+                                    return true;
+                                solution[newParent].otherChildren[i] = newChild;
+                                solution[newChild].parent = newParent;
+                            }
                         }
                     }
-                }
-                if (ringChain.size() >= 2)
-                    continue;
+                    if (ringChain.size() >= 2)
+                        continue;
 
-                // Adding ring as part of main path
-                costOfAddingNode = 0;
-                // TODO: the logic like this if/else one appears in at least one more place, maybe more
-                if (solution[newParent].otherChildren.empty()) {
-                    costOfAddingNode -= costEx[newChild][newParent][solution[newParent].parent];
-                    costOfAddingNode += costEx[node][newParent][solution[newParent].parent];
-                } else {
-                    costOfAddingNode -= costEx.withRespawn(newChild, newParent);
-                    costOfAddingNode += costEx.withRespawn(node, newParent);
+                    // Adding ring as part of main path
+                    costOfAddingNode = 0;
+                    // TODO: the logic like this if/else one appears in at least one more place, maybe more
+                    if (solution[newParent].otherChildren.empty()) {
+                        costOfAddingNode -= costEx[newChild][newParent][solution[newParent].parent];
+                        costOfAddingNode += costEx[node][newParent][solution[newParent].parent];
+                    } else {
+                        costOfAddingNode -= costEx.withRespawn(newChild, newParent);
+                        costOfAddingNode += costEx.withRespawn(node, newParent);
+                    }
+                    costOfAddingNode += costEx[newChild][node][newParent];
+                    costOfAddingNode -= calculateDifferentOutCostsWithNewPrevNode(config, solution, newChild, newParent);
+                    costOfAddingNode += calculateDifferentOutCostsWithNewPrevNode(config, solution, newChild, node);
+                    if (tryAddNewSolutionPath(newChild, true))
+                        return true;
                 }
-                costOfAddingNode += costEx[newChild][node][newParent];
-                costOfAddingNode -= calculateDifferentOutCostsWithNewPrevNode(config, solution, newChild, newParent);
-                costOfAddingNode += calculateDifferentOutCostsWithNewPrevNode(config, solution, newChild, node);
-                if (tryAddNewSolutionPath(newChild, true))
-                    return true;
-            }
-        }
-        if (solution[node].isOnMainPath || !solution[solution[node].parent].isOnMainPath) {
-            solution[parent].mainChild = chainStart;
-            if (child != NullNode) {
-                solution[child].parent = ringChain.back();
             }
-        } else {
-            if (child == NullNode) {
-                solution[parent].otherChildren.emplace_back(chainStart);
+            if (solution[node].isOnMainPath || !solution[solution[node].parent].isOnMainPath) {
+                solution[parent].mainChild = chainStart;
+                if (child != NullNode) {
+                    solution[child].parent = ringChain.back();
+                }
             } else {
-                solution[child].parent = node;
-                solution[parent].otherChildren[childIndex] = node;
+                if (child == NullNode) {
+                    solution[parent].otherChildren.emplace_back(chainStart);
+                } else {
+                    solution[child].parent = node;
+                    solution[parent].otherChildren[childIndex] = node;
+                }
             }
         }
+        return false;
+    };
+
+    scan();
+    std::stable_sort(insertionTable.begin(), insertionTable.end(), [](auto& a, auto& b) { return a.cost < b.cost; });
+    for (auto& move : insertionTable) {
+        applyChainStart = move.chainStart;
+        applyIndex = move.index;
+        if (scan())
+            return true;
     }
     return false;
 }
 
-bool doubleBridge(SolutionConfig& config, VectorPoolAlloc<TreeNode>& solution, FastThreadSafeishHashSet<VectorPoolAlloc<TreeNode>>& processedSolutions) {
-    auto& cost = config.weights;
-    auto& costEx = config.condWeights;
+/*
+    Randomized double bridge: samples sampleCount random cuts A B C D -> A C B D of the main path
+    and takes the first one that makes the route faster. Every sample only changes 3 connections,
+    so it's evaluated from the out costs of the 6 CPs next to them instead of scanning all cut combinations.
+*/
+bool sampledDoubleBridge(SolutionConfig& config, VectorPoolAlloc<TreeNode>& solution, FingerprintSet& processedSolutions, XorShift64& rng, int sampleCount) {
+    thread_local std::vector<NodeType> mainPath;
+    mainPath.clear();
+    mainPath.push_back(0);
+    while (mainPath.back() != solution.size() - 1)
+        mainPath.push_back(solution[mainPath.back()].mainChild);
+    int M = mainPath.size();
+    if (M < 5)
+        return false;
 
-    std::vector<NodeType> solutionVec;
-    solutionVec.push_back(0);
-    while (solution[solutionVec.back()].mainChild != 0) {
-        solutionVec.push_back(solution[solutionVec.back()].mainChild);
-    }
+    auto fingerprint = tourFingerprint(solution);
+    FixedStackVector<NodeType, 6> changedNodes;
+    auto changedNodesCost = [&]() {
+        EdgeCostType result = 0;
+        for (auto node : changedNodes)
+            result += calculateOutCosts(config, solution, node);
+        return result;
+    };
+    for (int sample = 0; sample < sampleCount; ++sample) {
+        if (config.stopWorking())
+            return false;
+        std::array<int, 3> cuts;
+        for (auto& cut : cuts)
+            cut = 1 + rng() % (M - 1);
+        std::sort(cuts.begin(), cuts.end());
+        if (cuts[0] == cuts[1] || cuts[1] == cuts[2])
+            continue;
+        auto a = mainPath[cuts[0] - 1], bStart = mainPath[cuts[0]];
+        auto bEnd = mainPath[cuts[1] - 1], cStart = mainPath[cuts[1]];
+        auto cEnd = mainPath[cuts[2] - 1], d = mainPath[cuts[2]];
 
-    auto N = solutionVec.size();
-    auto next = [N](int i) { return (i + 1 == N)  ? (0)     : (i + 1); };
-    auto prev = [N](int i) { return (i - 1 == -1) ? (N - 1) : (i - 1); };
-
-    auto newSolution = solution;
-    for (int i_ = 0; i_ < N - 1; ++i_) {
-        auto i = solutionVec[i_];
-        auto iPrev = solution[i].otherChildren.empty() ? solution[i].parent : costEx[0][0].size() - 1;
-        auto soli = solution[i].mainChild;
-        for (int k_ = next(next(i_)); k_ != prev(i_); k_ = next(k_)) {
-            auto k = solutionVec[k_];
-            auto kPrev = solution[k].otherChildren.empty() ? solution[k].parent : costEx[0][0].size() - 1;
-            auto solk = solution[k].mainChild;
-            if (solk == 0)
-                continue;
-            EdgeCostType costChangeik = 0;
-
-            newSolution[i].mainChild = solution[k].mainChild;
-            newSolution[k].mainChild = solution[i].mainChild;
-            newSolution[newSolution[i].mainChild].parent = i;
-            newSolution[newSolution[k].mainChild].parent = k;
-            if (config.useExtendedMatrix) {
-                costChangeik -= costEx[soli][i][iPrev] + costEx[solk][k][kPrev];
-                costChangeik += costEx[newSolution[i].mainChild][i][iPrev] + costEx[newSolution[k].mainChild][k][kPrev];
-            } else {
-                costChangeik -= cost[soli][i] + cost[solk][k];
-                costChangeik += cost[solk][i] + cost[soli][k];
-            }
-            
-            if (costChangeik <= 0) {
-                for (int j_ = next(i_); j_ != prev(k_); j_ = next(j_)) {
-                    auto j = solutionVec[j_];
-                    auto jPrev = solution[j].otherChildren.empty() ? solution[j].parent : costEx[0][0].size() - 1;
-                    auto solj = solution[j].mainChild;
-                    if (solj == 0)
-                        continue;
-                    for (int m_ = next(k_); m_ != prev(i_); m_ = next(m_)) {
-                        auto m = solutionVec[m_];
-                        auto mPrev = solution[m].otherChildren.empty() ? solution[m].parent : costEx[0][0].size() - 1;
-                        if (solution[m].mainChild == 0)
-                            continue;
+        changedNodes.clear();
+        for (auto node : { a, bStart, bEnd, cStart, cEnd, d }) {
+            if (node != solution.size() - 1 && std::find(changedNodes.begin(), changedNodes.end(), node) == changedNodes.end())
+                changedNodes.emplace_back(node);
+        }
+        auto oldCost = changedNodesCost();
+        auto oldNodesFingerprint = nodesFingerprint(solution, { a, bStart, bEnd, cStart, cEnd, d });
 
-                        newSolution[m].mainChild = solution[j].mainChild;
-                        newSolution[j].mainChild = solution[m].mainChild;
-                        newSolution[newSolution[j].mainChild].parent = j;
-                        newSolution[newSolution[m].mainChild].parent = m;
-
-                        auto newjPrev = newSolution[j].otherChildren.empty() ? newSolution[j].parent : costEx[0][0].size() - 1;
-                        auto newmPrev = newSolution[m].otherChildren.empty() ? newSolution[m].parent : costEx[0][0].size() - 1;
-
-                        EdgeCostType costChange = costChangeik;
-                        if (config.useExtendedMatrix) {
-                            costChange -= costEx[solj][j][jPrev] + costEx[solution[m].mainChild][m][mPrev];
-                            costChange += costEx[newSolution[j].mainChild][j][newjPrev] + costEx[newSolution[m].mainChild][m][newmPrev];
-                            if (solution[i].mainChild != j) {
-                                costChange -= calculateDifferentOutCostsWithNewPrevNode(config, solution, solution[i].mainChild, i);
-                                costChange += calculateDifferentOutCostsWithNewPrevNode(config, newSolution, solution[i].mainChild, k);
-                            }
-                            if (solution[j].mainChild != k) {
-                                costChange -= calculateDifferentOutCostsWithNewPrevNode(config, solution, solution[j].mainChild, j);
-                                costChange += calculateDifferentOutCostsWithNewPrevNode(config, newSolution, solution[j].mainChild, m);
-                            }
-                            if (solution[k].mainChild != m) {
-                                costChange -= calculateDifferentOutCostsWithNewPrevNode(config, solution, solution[k].mainChild, k);
-                                costChange += calculateDifferentOutCostsWithNewPrevNode(config, newSolution, solution[k].mainChild, i);
-                            }
-                            if (solution[m].mainChild != i) {
-                                costChange -= calculateDifferentOutCostsWithNewPrevNode(config, solution, solution[m].mainChild, m);
-                                costChange += calculateDifferentOutCostsWithNewPrevNode(config, newSolution, solution[m].mainChild, j);
-                            }
-                        } else {
-                            costChange -= cost[solj][j] + cost[solution[m].mainChild][m];
-                            costChange += cost[solj][m] + cost[solution[m].mainChild][j];
-                        }
-                        if (costChange < 0 && !processedSolutions.find(newSolution)) {
-                            solution = newSolution;
-                            processedSolutions.insert(solution);
-                            return true;
-                        }
-                        newSolution[newSolution[j].mainChild].parent = m;
-                        newSolution[newSolution[m].mainChild].parent = j;
-                        newSolution[j].mainChild = solution[j].mainChild;
-                        newSolution[m].mainChild = solution[m].mainChild;
-                    }
+        solution[a].mainChild = cStart;
+        solution[cStart].parent = a;
+        solution[cEnd].mainChild = bStart;
+        solution[bStart].parent = cEnd;
+        solution[bEnd].mainChild = d;
+        solution[d].parent = bEnd;
+
+        if (changedNodesCost() < oldCost && processedSolutions.insert(fingerprint ^ oldNodesFingerprint ^ nodesFingerprint(solution, { a, bStart, bEnd, cStart, cEnd, d })))
+            return true;
+
+        solution[a].mainChild = bStart;
+        solution[bStart].parent = a;
+        solution[bEnd].mainChild = cStart;
+        solution[cStart].parent = bEnd;
+        solution[cEnd].mainChild = d;
+        solution[d].parent = cEnd;
+    }
+    return false;
+}
+
+/*
+    Or-opt / segment insertion: moves a chain of up to maxSegmentLength consecutive main path CPs
+    in between two other consecutive main path CPs, keeping its direction so it's a valid move for asymmetric times.
+    Only positions where the connection out of the chain is in adjList are tried.
+*/
+bool insertSegment(SolutionConfig& config, const std::vector<std::vector<NodeType>>& adjList, VectorPoolAlloc<TreeNode>& solution, FingerprintSet& processedSolutions, int maxSegmentLength) {
+    NodeType finish = solution.size() - 1;
+    auto fingerprint = tourFingerprint(solution);
+    FixedStackVector<NodeType, 6> changedNodes;
+    auto changedNodesCost = [&]() {
+        EdgeCostType result = 0;
+        for (auto node : changedNodes)
+            result += calculateOutCosts(config, solution, node);
+        return result;
+    };
+    for (NodeType segStart = solution[0].mainChild; segStart != finish; segStart = solution[segStart].mainChild) {
+        if (config.stopWorking())
+            return false;
+        FastStackBitset isInSegment;
+        auto a = solution[segStart].parent;
+        auto segEnd = segStart;
+        for (int segLength = 1; segLength <= maxSegmentLength && segEnd != finish; ++segLength, segEnd = solution[segEnd].mainChild) {
+            isInSegment.set(segEnd);
+            auto b = solution[segEnd].mainChild;
+            for (auto d : adjList[segEnd]) {
+                if (d == 0 || d == b || !solution[d].isOnMainPath || isInSegment.test(d))
+                    continue;
+                auto c = solution[d].parent;
+                changedNodes.clear();
+                for (auto node : { a, b, c, d, segStart, segEnd }) {
+                    if (node != finish && std::find(changedNodes.begin(), changedNodes.end(), node) == changedNodes.end())
+                        changedNodes.emplace_back(node);
                 }
+                auto oldCost = changedNodesCost();
+                auto oldNodesFingerprint = nodesFingerprint(solution, { a, b, c, d, segStart, segEnd });
+
+                solution[a].mainChild = b;
+                solution[b].parent = a;
+                solution[c].mainChild = segStart;
+                solution[segStart].parent = c;
+                solution[segEnd].mainChild = d;
+                solution[d].parent = segEnd;
+
+                if (changedNodesCost() < oldCost && processedSolutions.insert(fingerprint ^ oldNodesFingerprint ^ nodesFingerprint(solution, { a, b, c, d, segStart, segEnd })))
+                    return true;
+
+                solution[a].mainChild = segStart;
+                solution[segStart].parent = a;
+                solution[segEnd].mainChild = b;
+                solution[b].parent = segEnd;
+                solution[c].mainChild = d;
+                solution[d].parent = c;
             }
-            newSolution[newSolution[i].mainChild].parent = k;
-            newSolution[newSolution[k].mainChild].parent = i;
-            newSolution[i].mainChild = solution[i].mainChild;
-            newSolution[k].mainChild = solution[k].mainChild;
         }
     }
     return false;
 }
-bool linKernighanRec(SolutionConfig& config, const std::vector<std::vector<NodeType>>& adjList, VectorPoolAlloc<TreeNode>& solution, EdgeCostType costChange, NodeType curNode, NodeType endNode, int addedEdgesCount, FastStackBitset& bannedDstNodes, const std::vector<int>& maxSearchWidths, FastThreadSafeishHashSet<VectorPoolAlloc<TreeNode>>& processedSolutions, std::atomic<bool>& stopWorking) {
-    if (config.stopWorking() || stopWorking)
+/*
+    Don't-look bits for linKernighan. Only start nodes next to connections that changed since
+    they were last tried are tried again. The mask of nodes that can't be moved is only rebuilt
+    in reset, which has to be called whenever the solution was changed by anything else than linKernighan.
+*/
+struct LinKernighanActiveNodes {
+    std::deque<NodeType> queue;
+    FastStackBitset isQueued;
+    FastStackBitset bannedDstNodes;
+    std::vector<NodeType> changedNodes;
+
+    void push(NodeType node) {
+        if (node == NullNode || isQueued.test(node))
+            return;
+        isQueued.set(node);
+        queue.push_back(node);
+    }
+    void reset(const VectorPoolAlloc<TreeNode>& solution) {
+        queue.clear();
+        isQueued.reset();
+        bannedDstNodes.reset();
+        bannedDstNodes.set(0);
+        for (NodeType n = 0; n < solution.size(); ++n) {
+            if (!solution[n].isOnMainPath)
+                bannedDstNodes.set(n);
+        }
+        for (NodeType n = 0; n != solution.size() - 1; n = solution[n].mainChild)
+            push(n);
+    }
+};
+bool linKernighanRec(SolutionConfig& config, const std::vector<std::vector<NodeType>>& adjList, VectorPoolAlloc<TreeNode>& solution, EdgeCostType costChange, NodeType curNode, NodeType endNode, int addedEdgesCount, FastStackBitset& bannedDstNodes, const std::vector<int>& maxSearchWidths, FingerprintSet& processedSolutions, uint64_t fingerprint, std::vector<NodeType>& changedNodes) {
+    if (config.stopWorking())
         return false;
     
     auto& cost = config.weights;
@@ -551,10 +663,13 @@ bool linKernighanRec(SolutionConfig& config, const std::vector<std::vector<NodeT
             auto oldSrcNode = solution[newDstNode].parent;
             auto oldDstNode = solution[curNode].mainChild;
 
+            auto newFingerprint = fingerprint ^ nodesFingerprint(solution, { curNode, newDstNode });
             solution[curNode].mainChild = newDstNode;
             solution[newDstNode].parent = curNode;
-            if (linKernighanRec(config, adjList, solution, newCostChange, oldSrcNode, endNode, addedEdgesCount + 1, bannedDstNodes, maxSearchWidths, processedSolutions, stopWorking)) {
+            newFingerprint ^= nodesFingerprint(solution, { curNode, newDstNode });
+            if (linKernighanRec(config, adjList, solution, newCostChange, oldSrcNode, endNode, addedEdgesCount + 1, bannedDstNodes, maxSearchWidths, processedSolutions, newFingerprint, changedNodes)) {
                 bannedDstNodes.reset(newDstNode);
+                changedNodes.insert(changedNodes.end(), { curNode, newDstNode, oldSrcNode, oldDstNode });
                 return true;
             }
             if (config.stopWorking())
@@ -570,10 +685,12 @@ bool linKernighanRec(SolutionConfig& config, const std::vector<std::vector<NodeT
         if (endCostGain < 0) {
             auto oldDstNode = solution[curNode].mainChild;
             auto oldParent = solution[endNode].parent;
+            auto newFingerprint = fingerprint ^ nodesFingerprint(solution, { curNode, endNode });
             solution[curNode].mainChild = endNode;
             solution[endNode].parent = curNode;
-            if (!processedSolutions.find(solution)) {
-                processedSolutions.insert(solution);
+            newFingerprint ^= nodesFingerprint(solution, { curNode, endNode });
+            if (processedSolutions.insert(newFingerprint)) {
+                changedNodes.insert(changedNodes.end(), { curNode, endNode, oldDstNode, oldParent });
                 return true;
             }
             solution[curNode].mainChild = oldDstNode;
@@ -583,26 +700,313 @@ bool linKernighanRec(SolutionConfig& config, const std::vector<std::vector<NodeT
 
     return false;
 }
-bool linKernighan(SolutionConfig& config, const std::vector<std::vector<NodeType>>& adjList, VectorPoolAlloc<TreeNode>& solution, const std::vector<int>& maxSearchWidths, FastThreadSafeishHashSet<VectorPoolAlloc<TreeNode>>& processedSolutions, std::atomic<bool>& stopWorking) {
-    NodeType startNode = 0;
-    for (NodeType startNode = 0; startNode != solution.size() - 1; startNode = solution[startNode].mainChild) {
+bool linKernighan(SolutionConfig& config, const std::vector<std::vector<NodeType>>& adjList, VectorPoolAlloc<TreeNode>& solution, const std::vector<int>& maxSearchWidths, FingerprintSet& processedSolutions, LinKernighanActiveNodes& activeNodes) {
+    auto fingerprint = tourFingerprint(solution);
+    while (!activeNodes.queue.empty()) {
         if (config.stopWorking())
             return false;
+        NodeType startNode = activeNodes.queue.front();
+        activeNodes.queue.pop_front();
+        activeNodes.isQueued.reset(startNode);
+        if (!solution[startNode].isOnMainPath || startNode == solution.size() - 1)
+            continue;
         NodeType endNode = solution[startNode].mainChild;
-        FastStackBitset bannedDstNodes;
-        bannedDstNodes.set(0);
+        FastStackBitset bannedDstNodes = activeNodes.bannedDstNodes;
         bannedDstNodes.set(endNode);
-        for (NodeType n = 0; n < config.nodeCount(); ++n) {
-            if (!solution[n].isOnMainPath) {
-                bannedDstNodes.set(n);
+        activeNodes.changedNodes.clear();
+        if (linKernighanRec(config, adjList, solution, 0, startNode, endNode, 0, bannedDstNodes, maxSearchWidths, processedSolutions, fingerprint, activeNodes.changedNodes)) {
+            activeNodes.push(startNode);
+            for (auto node : activeNodes.changedNodes) {
+                /* with sequence dependent times moves next to the changed connections can change cost too */
+                activeNodes.push(solution[node].parent);
+                activeNodes.push(node);
+                activeNodes.push(solution[node].mainChild);
             }
-        }
-        if (linKernighanRec(config, adjList, solution, 0, startNode, endNode, 0, bannedDstNodes, maxSearchWidths, processedSolutions, stopWorking)) {
             return true;
         }
     }
     return false;
 }
+/*
+    Connections the search is allowed to add going out of every node.
+    With candidateListSize > 0 connection i -> j is kept only if it's among the candidateListSize
+    cheapest connections going out of i or coming into j (by time with the best previous CP),
+    and the lists are sorted from the cheapest so the most promising moves are tried first.
+*/
+std::vector<std::vector<NodeType>> createCandidateLists(const SolutionConfig& config, int candidateListSize) {
+    auto N = config.nodeCount();
+    auto& cost = config.weights;
+    std::vector<std::vector<NodeType>> adjList(N);
+    std::vector<std::vector<NodeType>> revAdjList(N);
+    for (int i = 0; i < N; ++i) {
+        for (int j = 0; j < N; ++j) {
+            if (i == j)
+                continue;
+            if (cost[j][i] < config.ignoredValue) {
+                adjList[i].push_back(j);
+                revAdjList[j].push_back(i);
+            }
+        }
+    }
+    if (candidateListSize <= 0)
+        return adjList;
+
+    std::vector<std::vector<bool>> isCandidate(N, std::vector<bool>(N, false));
+    for (int i = 0; i < N; ++i) {
+        std::sort(adjList[i].begin(), adjList[i].end(), [&](auto a, auto b) { return cost[a][i] < cost[b][i]; });
+        std::sort(revAdjList[i].begin(), revAdjList[i].end(), [&](auto a, auto b) { return cost[i][a] < cost[i][b]; });
+        for (int k = 0; k < adjList[i].size() && k < candidateListSize; ++k)
+            isCandidate[i][adjList[i][k]] = true;
+        for (int k = 0; k < revAdjList[i].size() && k < candidateListSize; ++k)
+            isCandidate[revAdjList[i][k]][i] = true;
+    }
+    for (int i = 0; i < N; ++i) {
+        std::erase_if(adjList[i], [&](auto j) { return !isCandidate[i][j]; });
+    }
+    return adjList;
+}
+
+/*
+    Tour merging: replaces main path of solution with the fastest main path that only uses connections
+    from main paths of solution and other, if it's faster than the current one.
+    Both routes need to have the same CPs on the main path - subtrees (ring CPs) of solution are kept.
+    Every CP has at most 2 ways out in the union of connections, so the DFS over it is small when
+    the routes are similar, and it's cut short after MaxSearchNodeCount steps when they aren't.
+*/
+bool mergeSolutions(SolutionConfig& config, VectorPoolAlloc<TreeNode>& solution, const VectorPoolAlloc<TreeNode>& other, FingerprintSet& processedSolutions) {
+    constexpr int MaxSearchNodeCount = 100'000;
+    auto& costEx = config.condWeights;
+    NodeType finish = solution.size() - 1;
+    int mainPathSize = 0;
+    int differentConnectionCount = 0;
+    for (NodeType n = 0; n < solution.size(); ++n) {
+        if (solution[n].isOnMainPath != other[n].isOnMainPath)
+            return false;
+        if (!solution[n].isOnMainPath)
+            continue;
+        mainPathSize += 1;
+        if (n != finish && solution[n].mainChild != other[n].mainChild)
+            differentConnectionCount += 1;
+    }
+    if (differentConnectionCount == 0)
+        return false;
+
+    auto outCost = [&](NodeType cur, NodeType prev, NodeType next) {
+        if (solution[cur].otherChildren.empty())
+            return EdgeCostType(costEx[next][cur][prev]);
+        return calculateBranchingSubPathEdgeCosts(config, solution, cur, prev).first + costEx.withRespawn(next, cur);
+    };
+    EdgeCostType bestCost = 0;
+    for (NodeType n = 0; n != finish; n = solution[n].mainChild)
+        bestCost += outCost(n, solution[n].parent, solution[n].mainChild);
+
+    FastStackBitset visited;
+    std::vector<NodeType> path = { 0 };
+    std::vector<NodeType> bestPath;
+    int searchNodeCount = 0;
+    auto search = [&](auto& search, NodeType prev, EdgeCostType cost) -> void {
+        auto cur = path.back();
+        if (cur == finish) {
+            if (path.size() == mainPathSize && cost < bestCost) {
+                bestCost = cost;
+                bestPath = path;
+            }
+            return;
+        }
+        if (++searchNodeCount > MaxSearchNodeCount)
+            return;
+        for (auto next : { solution[cur].mainChild, other[cur].mainChild }) {
+            if (visited.test(next) || next == 0)
+                continue;
+            auto newCost = cost + outCost(cur, prev, next);
+            if (newCost >= bestCost)
+                continue;
+            visited.set(next);
+            path.push_back(next);
+            search(search, cur, newCost);
+            path.pop_back();
+            visited.reset(next);
+            if (solution[cur].mainChild == other[cur].mainChild)
+                break;
+        }
+    };
+    visited.set(0);
+    search(search, solution[0].parent, 0);
+    if (bestPath.empty())
+        return false;
+
+    auto merged = solution;
+    for (int i = 0; i + 1 < bestPath.size(); ++i) {
+        merged[bestPath[i]].mainChild = bestPath[i + 1];
+        merged[bestPath[i + 1]].parent = bestPath[i];
+    }
+    if (!processedSolutions.insert(tourFingerprint(merged)))
+        return false;
+    solution = merged;
+    return true;
+}
+
+void createSolutionFromEdges(VectorPoolAlloc<TreeNode>& solution, std::vector<SolutionEdge> edges) {
+    auto N = solution.size();
+    std::stable_sort(edges.begin(), edges.end(), [](auto& a, auto& b) {
+        return a.src > b.src;
+    });
+    NodeType lastSrc = NullNode;
+    for (int i = edges.size() - 1; i >= 0; --i) {
+        auto& edge = edges[i];
+        solution[edge.dst].parent = edge.src;
+        if (edge.src == lastSrc) {
+            solution[edge.src].otherChildren.emplace_back(edge.dst);
+        } else {
+            solution[edge.src].mainChild = edge.dst;
+        }
+        lastSrc = edge.src;
+    }
+    solution[0].parent = N - 1;
+    solution[N - 1].mainChild = 0;
+    auto n = NodeType(N - 1);
+    do {
+        solution[n].isOnMainPath = true;
+        n = solution[n].parent;
+    } while (n != 0);
+}
+
+/*
+    Merges solution with one of the best routes found so far (by all threads).
+*/
+bool mergeWithBestSolution(SolutionConfig& config, VectorPoolAlloc<TreeNode>& solution, const VectorPoolAlloc<TreeNode>& nodesBase, FingerprintSet& processedSolutions, XorShift64& rng) {
+    constexpr int EliteSolutionCount = 10;
+    std::vector<SolutionEdge> edges;
+    {
+        std::scoped_lock l{ config.solutionUpdateMutex };
+        if (config.bestSolutions.empty())
+            return false;
+        auto eliteCount = std::min<int>(EliteSolutionCount, config.bestSolutions.size());
+        edges = config.bestSolutions[rng() % eliteCount].solution();
+    }
+    auto other = nodesBase;
+    createSolutionFromEdges(other, std::move(edges));
+    return mergeSolutions(config, solution, other, processedSolutions);
+}
+
+EdgeCostType calculateSolutionTime(SolutionConfig& config, const VectorPoolAlloc<TreeNode>& nodes) {
+    EdgeCostType result = 0;
+    for (NodeType n = 0; n < nodes.size() - 1; ++n) {
+        if (nodes[n].isOnMainPath)
+            result += calculateOutCosts(config, nodes, n);
+        else if (nodes[n].parent != NullNode && nodes[n].mainChild != NullNode)
+            result += config.condWeights[nodes[n].mainChild][n][nodes[n].parent];
+    }
+    return result;
+}
+
+/*
+    Segment double bridge: picks 3 random cuts inside a random window of kickSize consecutive main path CPs
+    and swaps the two middle parts (A B C D -> A C B D), so the kick stays local.
+*/
+void segmentDoubleBridge(VectorPoolAlloc<TreeNode>& solution, int kickSize, XorShift64& rng) {
+    std::vector<NodeType> mainPath = { 0 };
+    while (mainPath.back() != solution.size() - 1)
+        mainPath.push_back(solution[mainPath.back()].mainChild);
+    int M = mainPath.size();
+    if (M < 4)
+        return;
+    int windowSize = std::clamp(kickSize, 3, M - 1);
+    int windowStart = 1 + rng() % (M - windowSize);
+    std::array<int, 3> cuts;
+    do {
+        for (auto& cut : cuts)
+            cut = windowStart + rng() % windowSize;
+        std::sort(cuts.begin(), cuts.end());
+    } while (cuts[0] == cuts[1] || cuts[1] == cuts[2]);
+    auto [i, j, k] = cuts;
+
+    std::vector<NodeType> newMainPath(mainPath.begin(), mainPath.begin() + i);
+    newMainPath.insert(newMainPath.end(), mainPath.begin() + j, mainPath.begin() + k);
+    newMainPath.insert(newMainPath.end(), mainPath.begin() + i, mainPath.begin() + j);
+    newMainPath.insert(newMainPath.end(), mainPath.begin() + k, mainPath.end());
+    for (int n = 0; n + 1 < M; ++n) {
+        solution[newMainPath[n]].mainChild = newMainPath[n + 1];
+        solution[newMainPath[n + 1]].parent = newMainPath[n];
+    }
+}
+
+/*
+    Pool of elite routes shared by all heuristic workers. Once the first tries found some local optima,
+    most tries start from a kicked copy of a random route from the pool instead of a random route,
+    and the optimized route can replace the route it started from according to settings.kickAcceptance.
+    Kick size grows while tries don't find anything faster than the route they started from and goes back to the minimum when they do.
+*/
+struct ElitePool {
+    static constexpr int MinKickSize = 4;
+    static constexpr int MaxSize = 8;
+
+    ElitePool(const LinKernighanSettings& settings) : settings(settings) {}
+
+    /* copies random route from the pool into solution and kicks it if kick is set. Returns false if pool is empty */
+    bool get(VectorPoolAlloc<TreeNode>& solution, EdgeCostType& startTime, uint64_t& startFingerprint, bool kick, XorShift64& rng) {
+        int curKickSize;
+        {
+            std::scoped_lock l{ mutex };
+            if (entries.empty())
+                return false;
+            auto& entry = entries[rng() % entries.size()];
+            solution = entry.solution;
+            startTime = entry.time;
+            startFingerprint = entry.fingerprint;
+            curKickSize = kickSize;
+        }
+        if (kick)
+            segmentDoubleBridge(solution, curKickSize, rng);
+        return true;
+    }
+    /* startTime and startFingerprint describe the route the try started from (startTime is Inf if it wasn't from the pool) */
+    void update(const VectorPoolAlloc<TreeNode>& solution, EdgeCostType time, EdgeCostType startTime, uint64_t startFingerprint) {
+        auto fingerprint = tourFingerprint(solution);
+        std::scoped_lock l{ mutex };
+        if (startTime != Inf) {
+            if (time < startTime)
+                kickSize = MinKickSize;
+            else
+                kickSize = std::min<int>(kickSize + 1, solution.size());
+        }
+        for (auto& entry : entries) {
+            if (entry.fingerprint == fingerprint)
+                return;
+        }
+        auto best = std::min_element(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.time < b.time; });
+        auto worst = std::max_element(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.time < b.time; });
+        auto parent = std::find_if(entries.begin(), entries.end(), [&](auto& e) { return e.fingerprint == startFingerprint; });
+        if (startTime != Inf && parent != entries.end() && (parent != best || time < parent->time)) {
+            auto timeDiff = time - parent->time;
+            bool accept = timeDiff < 0;
+            if (!accept && settings.kickAcceptance == KickAcceptance::Threshold) {
+                accept = timeDiff <= settings.kickAcceptanceTime;
+            } else if (!accept && settings.kickAcceptance == KickAcceptance::Annealing) {
+                accept = double(rng()) / XorShift64::max() < std::exp(-double(timeDiff) / std::max(settings.kickAcceptanceTime, 1));
+            }
+            if (accept)
+                *parent = Entry{ solution, time, fingerprint };
+        } else if (entries.size() < MaxSize) {
+            entries.push_back(Entry{ solution, time, fingerprint });
+        } else if (time < worst->time) {
+            *worst = Entry{ solution, time, fingerprint };
+        }
+    }
+
+private:
+    struct Entry {
+        VectorPoolAlloc<TreeNode> solution;
+        EdgeCostType time;
+        uint64_t fingerprint;
+    };
+    std::mutex mutex;
+    std::vector<Entry> entries;
+    int kickSize = MinKickSize;
+    XorShift64 rng;
+    const LinKernighanSettings& settings;
+};
+
 void generateRandomSolution(int tryId, VectorPoolAlloc<TreeNode>& nodes, XorShift64& rng, EdgeCostType ignoredValue, const ConditionalMatrix<int>& costEx) {
     auto N = costEx.data.size();
     std::vector<int> solutionVec(N);
@@ -624,7 +1028,6 @@ void generateRandomSolution(int tryId, VectorPoolAlloc<TreeNode>& nodes, XorShif
 
 void findSolutionsLinKernighan(SolutionConfig& config, LinKernighanSettings settings) {
     auto N = int(config.nodeCount());
-    auto& cost = config.weights;
     auto& costEx = config.condWeights;
 
     FastStackBitset isRingCp;
@@ -641,120 +1044,147 @@ void findSolutionsLinKernighan(SolutionConfig& config, LinKernighanSettings sett
         nodesBase[i].isRingCp = isRingCp.test(i);
     }
 
-    std::vector<std::vector<NodeType>> adjList(N);
-    for (int i = 0; i < N; ++i) {
-        for (int j = 0; j < N; ++j) {
-            if (i == j)
-                continue;
-            if (cost[j][i] < config.ignoredValue) {
-                adjList[i].push_back(j);
-            }
-        }
-    }
+    auto adjList = createCandidateLists(config, settings.candidateListSize);
 
     const int ThreadCount = (std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 1;
-    ThreadPool threadPool(ThreadCount);
+    const int TryCount = settings.tryCount + ThreadCount * 2;
+    const int TriesPerSequenceLength = (TryCount + ThreadCount - 1) / ThreadCount;
+    constexpr int RandomTryInterval = 4; // some tries still start from a random route to keep the found routes diverse
+    constexpr int MaxMergeCount = 3;
 
-    for (int maxSequenceLength = 4; maxSequenceLength < N; maxSequenceLength += 2) {
-        if (config.stopWorking())
-            break;
-        if (maxSequenceLength >= settings.maxSequenceLengthLimit)
-            break;
+    ElitePool elitePool(settings);
+    // tries insert a few dozen fingerprints per node, keep the set at most ~1/4 full but don't go over 128/512MB
+    auto expectedFingerprintCount = uint64_t(TryCount) * N * 64;
+    auto fingerprintSetPower = std::clamp(int(mostSignificantBitPosition(expectedFingerprintCount)) + 3, 16, settings.maxSequenceLengthLimit <= 8 ? 24 : 26);
+    FingerprintSet processedSolutions(fingerprintSetPower);
+    std::atomic<int> nextTryId = 0;
+    config.partialSolutionCount.store(int128_t(4 + 1, 0));
+
+    /*
+        Every worker raises its own k-opt depth after it did its share of tries at the current depth,
+        or earlier if half of them in a row didn't improve the elite route they started from.
+        The first try at the new depth polishes a route from the elite pool without kicking it.
+    */
+    auto worker = [&](int threadId) {
+        XorShift64 rng(threadId + 1);
+        BranchCostCache branchCostCache(N);
         std::vector<int> maxSearchWidths(N, 0);
-        for (int i = 0; i < maxSequenceLength; ++i) {
-            maxSearchWidths[i] = N;
-        }
-        XorShift64 rng;
-        FastThreadSafeishHashSet<VectorPoolAlloc<TreeNode>> processedSolutions(3'000'000'000 / (N * sizeof(TreeNode)), maxSequenceLength < 8 ? 24 : 26);
-        std::atomic<bool> stopWorking = false;
+        int maxSequenceLength = 2;
+        int triesAtSequenceLength = TriesPerSequenceLength;
+        int triesWithoutImprovement = 0;
+        while (!config.stopWorking()) {
+            bool polish = false;
+            if (triesAtSequenceLength >= TriesPerSequenceLength || triesWithoutImprovement >= (TriesPerSequenceLength + 1) / 2) {
+                maxSequenceLength += 2;
+                if (maxSequenceLength >= N || maxSequenceLength >= settings.maxSequenceLengthLimit)
+                    return;
+                for (int i = 0; i < maxSequenceLength; ++i)
+                    maxSearchWidths[i] = N;
+                {
+                    std::scoped_lock l{ config.partialSolutionCountMutex };
+                    auto count = config.partialSolutionCount.load();
+                    if (count.high < maxSequenceLength + 1)
+                        config.partialSolutionCount.store(int128_t(maxSequenceLength + 1, count.low));
+                }
+                triesAtSequenceLength = 0;
+                triesWithoutImprovement = 0;
+                polish = maxSequenceLength > 4;
+            }
+            triesAtSequenceLength += 1;
 
-        config.partialSolutionCount.store(int128_t(maxSequenceLength + 1, 0));
-        const int TryCount = settings.tryCount + ThreadCount * 2;
-        for (int tryId = 0; tryId < TryCount; ++tryId) {
             auto solution = nodesBase;
-            if (tryId < settings.initialSolutions.size()) {
-                auto s = settings.initialSolutions[tryId].solution();
-                std::stable_sort(s.begin(), s.end(), [](auto& a, auto& b) {
-                    return a.src > b.src;
-                });
-                NodeType lastSrc = NullNode;
-                for (int i = s.size() - 1; i >= 0; --i) {
-                    auto& edge = s[i];
-                    solution[edge.dst].parent = edge.src;
-                    if (edge.src == lastSrc) {
-                        solution[edge.src].otherChildren.emplace_back(edge.dst);
-                    } else {
-                        solution[edge.src].mainChild = edge.dst;
-                    }
-                    lastSrc = edge.src;
-                }
-                solution[0].parent = N - 1;
-                solution[N - 1].mainChild = 0;
-                auto n = NodeType(N - 1);
-                do {
-                    solution[n].isOnMainPath = true;
-                    n = solution[n].parent;
-                } while (n != 0);
+            EdgeCostType startTime = Inf;
+            uint64_t startFingerprint = 0;
+            if (polish) {
+                if (!elitePool.get(solution, startTime, startFingerprint, false, rng))
+                    continue;
             } else {
-                generateRandomSolution(tryId, solution, rng, config.ignoredValue, costEx);
+                int tryId = nextTryId++;
+                bool isKickTry = settings.iteratedKicks && tryId >= settings.initialSolutions.size() + ThreadCount && tryId % RandomTryInterval != 0;
+                if (tryId < settings.initialSolutions.size()) {
+                    createSolutionFromEdges(solution, settings.initialSolutions[tryId].solution());
+                } else if (!isKickTry || !elitePool.get(solution, startTime, startFingerprint, true, rng)) {
+                    generateRandomSolution(tryId, solution, rng, config.ignoredValue, costEx);
+                }
+                if (!processedSolutions.insert(tourFingerprint(solution)))
+                    continue;
+                if (startTime == Inf)
+                    saveSolution(config, solution);
             }
 
-            if (processedSolutions.find(solution))
-                continue;
-            processedSolutions.insert(solution);
-            saveSolution(config, solution);
-
-            threadPool.addTask([&config, &adjList, &processedSolutions, &maxSearchWidths, &stopWorking, &settings, solution](int) mutable {
-                int count = 0;
+            LinKernighanActiveNodes activeNodes;
+            for (int mergeCount = 0; ; ++mergeCount) {
                 while (true) {
-                    if (config.stopWorking() || stopWorking)
+                    if (config.stopWorking())
                         return;
-                    while (linKernighan(config, adjList, solution, maxSearchWidths, processedSolutions, stopWorking)) {
+                    activeNodes.reset(solution);
+                    while (linKernighan(config, adjList, solution, maxSearchWidths, processedSolutions, activeNodes)) {
                         saveSolution(config, solution);
-                        if (config.stopWorking() || stopWorking)
+                        if (config.stopWorking())
                             return;
                     }
-                    if (config.stopWorking() || stopWorking)
+                    if (config.stopWorking())
+                        return;
+
+                    if (insertSegment(config, adjList, solution, processedSolutions, 3) || insertSegment(config, adjList, solution, processedSolutions, N)) {
+                        saveSolution(config, solution);
+                        continue;
+                    }
+                    if (config.stopWorking())
                         return;
 
                     if (settings.fullRingCpMode) {
                         bool madeChange = false;
-                        if (moveRingCp(config, solution, processedSolutions, 1, 0) || moveRingCp(config, solution, processedSolutions, 1, 30)) {
+                        if (moveRingCp(config, solution, processedSolutions, 1, 30)) {
                             saveSolution(config, solution);
                             madeChange = true;
                         }
-                        if (config.stopWorking() || stopWorking)
+                        if (config.stopWorking())
                             return;
 
-                        if (moveRingCp(config, solution, processedSolutions, 2, 0) || moveRingCp(config, solution, processedSolutions, 2, 30)) {
+                        if (moveRingCp(config, solution, processedSolutions, 2, 30)) {
                             saveSolution(config, solution);
                             madeChange = true;
                         }
-                        if (config.stopWorking() || stopWorking)
+                        if (config.stopWorking())
                             return;
 
-                        if (!madeChange && doubleBridge(config, solution, processedSolutions)) {
+                        if (!madeChange && sampledDoubleBridge(config, solution, processedSolutions, rng, N * N)) {
                             saveSolution(config, solution);
                             madeChange = true;
                         }
-                        if (config.stopWorking() || stopWorking)
+                        if (config.stopWorking())
                             return;
-                            
+
                         if (!madeChange)
                             break;
                     } else {
-                        if (!doubleBridge(config, solution, processedSolutions))
+                        if (!sampledDoubleBridge(config, solution, processedSolutions, rng, N * N))
                             break;
                         saveSolution(config, solution);
                     }
                 }
-                config.incrementPartialSolutionCount();
-            });
-        }
-        while (threadPool.remainingTasksInQueueCount() >= ThreadCount) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                if (config.stopWorking())
+                    return;
+                if (mergeCount >= MaxMergeCount || !mergeWithBestSolution(config, solution, nodesBase, processedSolutions, rng))
+                    break;
+                saveSolution(config, solution);
+            }
+            auto time = calculateSolutionTime(config, solution);
+            // random starts can't be compared to anything, so only tries from an elite route count here
+            if (startTime != Inf) {
+                if (time < startTime)
+                    triesWithoutImprovement = 0;
+                else
+                    triesWithoutImprovement += 1;
+            }
+            elitePool.update(solution, time, startTime, startFingerprint);
+            config.incrementPartialSolutionCount();
         }
-        stopWorking = true;
-        threadPool.wait();
-    }
+    };
+
+    ThreadPool threadPool(ThreadCount);
+    for (int i = 0; i < ThreadCount; ++i)
+        threadPool.addTask(worker);
+    threadPool.wait();
 }
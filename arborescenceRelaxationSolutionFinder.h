@@ -84,6 +84,8 @@ struct ArborescenceSolution : BranchAndBoundSolution<ArborescenceSolution> {
         return cost;
     }
 
+    static constexpr bool HasReducedCostBounds = false;
+
     bool shouldLockOutEdges() const {
         return false;
     }
@@ -267,13 +269,14 @@ struct ArborescenceSolution : BranchAndBoundSolution<ArborescenceSolution> {
     }
 
     void saveSolution(SolutionConfig& config) {
-        std::vector<std::vector<CompressedEdge>> allSolutions(1);
+        std::vector<NodeType> mainPath = { 0 };
+        std::vector<std::vector<std::vector<CompressedEdge>>> subTrees;
         NodeType cur = 0;
         while (cur != size() - 1) {
             auto mainPathNext = node(cur).firstChild;
-            std::vector<std::vector<CompressedEdge>> subTrees;
+            auto& nodeSubTrees = subTrees.emplace_back();
             for (auto next = node(mainPathNext).nextSibling; next != mainPathNext; next = node(next).nextSibling) {
-                auto& subTree = subTrees.emplace_back();
+                auto& subTree = nodeSubTrees.emplace_back();
                 auto subTreeSrc = cur;
                 auto subTreeDst = next;
                 while (subTreeDst != NullNode) {
@@ -282,33 +285,10 @@ struct ArborescenceSolution : BranchAndBoundSolution<ArborescenceSolution> {
                     subTreeDst = node(subTreeSrc).firstChild;
                 }
             };
-            if (subTrees.size() == 1) {
-                for (auto& solution : allSolutions) {
-                    solution.insert(solution.end(), subTrees[0].begin(), subTrees[0].end());
-                }
-            } else if (subTrees.size() >= 2) {
-                std::vector<std::vector<CompressedEdge>> newAllSolutions;
-                for (int i = 0; i < subTrees.size(); ++i) {
-                    auto allSolutionsCopy = allSolutions;
-                    for (auto& solution : allSolutionsCopy) {
-                        solution.insert(solution.end(), subTrees[i].begin(), subTrees[i].end());
-                        for (int j = 0; j < subTrees.size(); ++j) {
-                            if (i == j)
-                                continue;
-                            solution.insert(solution.end(), subTrees[j].begin(), subTrees[j].end());
-                        }
-                    }
-                    newAllSolutions.insert(newAllSolutions.end(), allSolutionsCopy.begin(), allSolutionsCopy.end());
-                }
-                allSolutions = std::move(newAllSolutions);
-            }
-            for (auto& solution : allSolutions)
-                solution.push_back(CompressedEdge{ 0, cur, mainPathNext });
+            mainPath.push_back(mainPathNext);
             cur = mainPathNext;
         }
-        for (auto& solution : allSolutions) {
-            ::saveSolution(config, solution);
-        }
+        saveSolutionsWithSubTreeOrders(config, mainPath, subTrees);
     }
 };
 
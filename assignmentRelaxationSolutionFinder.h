@@ -101,6 +101,12 @@ struct AssignmentSolution : BranchAndBoundSolution<AssignmentSolution> {
         return (*costMatrix)[j][i] - outReductions[i] - inReductions[j] + (useExtendedMatrix ? costIncreases[j * size() + i] : 0);
     }
 
+    // any assignment using edge (i, j) costs at least current assignment cost + reduced cost of that edge
+    static constexpr bool HasReducedCostBounds = true;
+    int forcedEdgeCostLowerBound(Edge edge) {
+        return cost + valueAt(edge.first, edge.second);
+    }
+
     bool shouldLockOutEdges() const {
         return true;
     }
@@ -294,3 +300,6 @@ struct AssignmentSolution : BranchAndBoundSolution<AssignmentSolution> {
 void findSolutionsAssignment(SolutionConfig& config) {
     findSolutionsBranchAndBound<AssignmentSolution>(config);
 }
+void findSolutionsAssignmentInProvenOrder(SolutionConfig& config) {
+    findSolutionsInProvenOrder<AssignmentSolution>(config);
+}
@@ -47,7 +47,7 @@ struct AdjList {
         if (newStride < stride_ - 5) { // only if significant change in stride
             for (int i = 1; i < size(); ++i) {
                 ArrayView newRow((ArrayViewData*)(data_.data + newStride * i));
-                std::memcpy(newRow.ptr_->data_ - 1, (*this)[i].ptr_->data_ - 1, ((*this)[i].ptr_->size_ + 1) * sizeof(NodeType));
+                std::memmove(newRow.ptr_->data_ - 1, (*this)[i].ptr_->data_ - 1, ((*this)[i].ptr_->size_ + 1) * sizeof(NodeType));
             }
             stride_ = newStride;
         }
@@ -556,9 +556,253 @@ template<typename BacklogType, typename SolutionType, typename FunctionType> voi
     delete[] threadIsWaiting;
 }
 
+template<typename SolutionType> int maxRelaxationRouteCost(SolutionType& solution) {
+    /*
+        Upper bound on the cost of any route left in the graph: every node is entered exactly once,
+        so a route can't cost more than the sum of the most expensive live in edges of all nodes.
+        With the extended matrix edge costs can be raised up to the largest conditional cost of that edge.
+    */
+    int maxCost = 0;
+    for (int dst = 0; dst < solution.size(); ++dst) {
+        int maxInCost = 0;
+        for (int k = 0; k < solution.revAdjList[dst].size(); ++k) {
+            int src = solution.revAdjList[dst][k];
+            int edgeCost = (*solution.costMatrix)[dst][src];
+            if (solution.useExtendedMatrix) {
+                for (auto value : (*solution.costMatrixEx)[dst][src]) {
+                    if (value < solution.ignoredValue)
+                        edgeCost = std::max(edgeCost, value);
+                }
+            }
+            maxInCost = std::max(maxInCost, edgeCost);
+        }
+        maxCost += maxInCost;
+    }
+    return maxCost;
+}
+
+template<typename SolutionType> bool removeEdgesExceedingLimit(SolutionConfig& config, SolutionType& rootSolution) {
+    /*
+        Before branching, permanently delete every edge that cannot be part of any route within the limit.
+        Edges are probed by locking them in a copy of the root and solving the relaxation again.
+        That's one relaxation solve per edge, so it's only done when the limit is tight enough for some route
+        in the graph to exceed it - with a loose limit no edge can be removed this way.
+        If the relaxation provides reduced costs (assignment), they bound the cost of a route forced to use the edge
+        for free - edges already over the limit are removed without a solve and only edges whose bound is
+        in the upper half of the gap between root cost and the limit are probed.
+        Returns false if it turns out there is no route within the limit at all.
+    */
+    if (!rootSolution.solveRelaxationAndCheckIfStillViable(config) || rootSolution.getCost() > config.limit())
+        return true; // nothing to gain, search will discard the root anyway
+    const int limit = config.limit();
+    if (maxRelaxationRouteCost(rootSolution) <= limit)
+        return true;
+    const int rootCost = rootSolution.getCost();
+    const int probeThreshold = rootCost + (limit - rootCost) / 2;
+
+#ifdef DEBUG
+    const int ThreadCount = 1;
+#else
+    const int ThreadCount = (std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 1;
+#endif
+    std::vector<std::vector<Edge>> edgesToRemove(rootSolution.size());
+    {
+        ThreadPool threadPool(ThreadCount);
+        for (int src = 0; src < rootSolution.size(); ++src) {
+            threadPool.addTask([&config, &rootSolution, &edgesToRemove, src, limit, probeThreshold](int) {
+                auto& adj = rootSolution.adjList;
+                for (int k = 0; k < adj[src].size(); ++k) {
+                    if (config.stopWorking())
+                        return;
+                    auto edge = Edge{ NodeType(src), adj[src][k] };
+                    if (rootSolution.lockedInEdges[edge.second] == edge.first)
+                        continue;
+                    if constexpr (SolutionType::HasReducedCostBounds) {
+                        auto bound = rootSolution.forcedEdgeCostLowerBound(edge);
+                        if (bound > limit) {
+                            edgesToRemove[src].push_back(edge);
+                            continue;
+                        }
+                        if (bound < probeThreshold)
+                            continue;
+                    }
+                    SolutionType probe = rootSolution;
+                    if (!probe.lockEdge(Out, edge) || probe.getCost() > limit || !probe.solveRelaxationAndCheckIfStillViable(config) || probe.getCost() > limit) {
+                        edgesToRemove[src].push_back(edge);
+                    }
+                }
+            });
+        }
+        threadPool.wait();
+    }
+    if (config.stopWorking())
+        return true;
+
+    for (auto& edges : edgesToRemove) {
+        for (auto edge : edges) {
+            if (!rootSolution.removeOutEdgeIfExists(edge))
+                return false;
+        }
+    }
+    rootSolution.shrinkToFit();
+    return true;
+}
+
 template<typename SolutionType> void findSolutionsBranchAndBound(SolutionConfig& config) {
     ArrayOfPoolAllocators freeLists(1024, 16, 3'000'000'000, SolutionType::RequiredAllocationSize(int(config.weights.size()), config.useExtendedMatrix));
     SolutionType initialSolution(freeLists, config);
+    if (!removeEdgesExceedingLimit(config, initialSolution))
+        return;
     initialSolution.shrinkToFit();
     findSolutionsBfs<std::pair<SolutionType, Edge>>(config, initialSolution, initialSolution.minimumAllocationSize(), findSolutions<SolutionType>);
 }
+
+template<typename SolutionType> void findSolutionsInProvenOrder(SolutionConfig& config) {
+    /*
+        Lawler/Murty style k-best enumeration.
+        Search space is split into disjoint partitions, each described by edges that have to be used
+        and edges that are banned. Every partition is solved for its single best route with the normal B&B.
+        The partition with the fastest route is taken out - its route is final, so it's saved right away -
+        and the rest of that partition is split again: i-th new partition uses the first i-1 edges
+        of the route and bans the i-th edge.
+        Routes are saved in order of their time, so e.g. the first route is known to be optimal
+        as soon as it is saved, while the next ones are still being calculated.
+
+        New partitions are solved lazily with increasing limit - without any limit B&B would have to
+        go through whole search space to prove that partition has no routes at all.
+        Partition that wasn't solved yet is kept in the queue with lower bound of its best route time,
+        starting from the relaxation value of the partition. Partitions whose relaxation has no solution
+        within the global limit are dropped right away.
+
+        Requires that every complete B&B solution corresponds to exactly one route.
+    */
+    struct Partition {
+        int time;
+        int limitStep;
+        bool isSolved;
+        std::vector<Edge> lockedEdges;
+        std::vector<Edge> removedEdges;
+        std::vector<NodeType> route;
+
+        bool operator<(const Partition& other) const {
+            if (time != other.time)
+                return time > other.time;
+            return isSolved < other.isSolved;
+        }
+    };
+
+    std::atomic<int> partitionLimit = config.limit();
+    SolutionConfig partitionConfig = config;
+    partitionConfig.limit_ = &partitionLimit;
+    partitionConfig.maxSolutionCount = 1;
+
+    ArrayOfPoolAllocators freeLists(1024, 16, 3'000'000'000, SolutionType::RequiredAllocationSize(int(config.weights.size()), config.useExtendedMatrix));
+    SolutionType rootSolution(freeLists, partitionConfig);
+
+    auto currentLimit = [&config]() {
+        if (config.bestSolutions.size() >= config.maxSolutionCount)
+            return std::min(config.limit(), config.bestSolutions.back().time);
+        return config.limit();
+    };
+    auto respectsPartition = [](const Partition& partition, const std::vector<NodeType>& route) {
+        for (auto edge : partition.lockedEdges) {
+            if (route[edge.first] != edge.second)
+                return false;
+        }
+        for (auto edge : partition.removedEdges) {
+            if (route[edge.first] == edge.second)
+                return false;
+        }
+        return true;
+    };
+    enum class PartitionStatus { Solved, NotWithinLimit, Empty };
+    auto solvePartition = [&](Partition& partition) -> PartitionStatus {
+        auto solution = rootSolution;
+        for (auto edge : partition.lockedEdges) {
+            if (!solution.lockEdge(Out, edge))
+                return PartitionStatus::Empty;
+        }
+        for (auto edge : partition.removedEdges) {
+            if (!solution.removeOutEdgeIfExists(edge))
+                return PartitionStatus::Empty;
+        }
+        partitionLimit = currentLimit();
+        if (!solution.solveRelaxationAndCheckIfStillViable(partitionConfig))
+            return PartitionStatus::Empty;
+        partition.time = std::max(partition.time, solution.getCost());
+
+        auto limit = std::min(currentLimit(), partition.time + partition.limitStep);
+        partitionConfig.clearBestSolutions();
+        partitionConfig.solutionsVec.clear();
+        partitionLimit = limit;
+        findSolutionsBfs<std::pair<SolutionType, Edge>>(partitionConfig, solution, solution.minimumAllocationSize(), findSolutions<SolutionType>);
+        config.incrementPartialSolutionCount();
+        auto notFound = [&]() {
+            if (limit >= currentLimit())
+                return PartitionStatus::Empty;
+            partition.time = limit + 1;
+            return PartitionStatus::NotWithinLimit;
+        };
+        if (partitionConfig.bestSolutions.empty())
+            return notFound();
+        // variations of the best route can include routes from outside of this partition, so pick the one that is inside
+        for (auto& variation : partitionConfig.bestSolutions[0].variations) {
+            std::vector<NodeType> route(config.nodeCount(), NullNode);
+            NodeType src = 0;
+            for (auto& edge : variation.solution) {
+                route[src] = edge.dst;
+                src = edge.dst;
+            }
+            route[src] = 0;
+            if (respectsPartition(partition, route)) {
+                partition.time = partitionConfig.bestSolutions[0].time;
+                partition.isSolved = true;
+                partition.route = std::move(route);
+                return PartitionStatus::Solved;
+            }
+        }
+        return notFound();
+    };
+
+    int rootTime;
+    {
+        auto solution = rootSolution;
+        if (!solution.solveRelaxationAndCheckIfStillViable(partitionConfig))
+            return;
+        rootTime = solution.getCost();
+    }
+
+    std::priority_queue<Partition> partitions;
+    partitions.push(Partition{ rootTime, std::max(1, rootTime / 100), false, {}, {}, {} });
+
+    while (!partitions.empty() && !config.stopWorking()) {
+        auto partition = partitions.top();
+        partitions.pop();
+        if (partition.time > currentLimit())
+            break;
+
+        if (!partition.isSolved) {
+            auto status = solvePartition(partition);
+            if (status == PartitionStatus::NotWithinLimit && !config.stopWorking()) {
+                partition.limitStep *= 2;
+                partitions.push(std::move(partition));
+            } else if (status == PartitionStatus::Solved) {
+                partitions.push(std::move(partition));
+            }
+            continue;
+        }
+
+        ::saveSolution(config, partition.route);
+
+        auto lockedEdges = partition.lockedEdges;
+        for (NodeType src = 0; src != config.nodeCount() - 1; src = partition.route[src]) {
+            auto edge = Edge{ src, partition.route[src] };
+            if (std::find(lockedEdges.begin(), lockedEdges.end(), edge) != lockedEdges.end())
+                continue;
+            Partition subPartition{ partition.time, std::max(1, partition.time / 100), false, lockedEdges, partition.removedEdges, {} };
+            subPartition.removedEdges.push_back(edge);
+            partitions.push(std::move(subPartition));
+            lockedEdges.push_back(edge);
+        }
+    }
+}
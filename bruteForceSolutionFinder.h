@@ -7,9 +7,24 @@ struct MinInNode {
     uint16_t cost;
 };
 
+template<int Size> struct BruteForceSharedData {
+    std::vector<std::vector<NodeType>> adjList;
+    std::vector<std::vector<NodeType>> revAdjList;
+    std::vector<std::bitset<Size>> possibleInNodes; // [dst] - revAdjList as bitset, minus srcNotToConsider gives sources still usable in a partial route
+    std::bitset<Size> isRingCp;
+    std::vector<int32_t> inCostsByPrev; // [(dst * nodeCount + src) * prevStride + prev] - condWeights padded for MaskedMinimum
+    int prevStride;
+    std::vector<Bool> outCostDependsOnPrev;
+    std::unique_ptr<KBestCostTable> dominanceTable; // null unless repeated partial routes are pruned
+};
+
+/*
+    Every partial route in the queue is a copy of this struct, so it holds only what can't be cheaply derived
+    from it after it's popped - lists of not visited nodes and previous nodes to consider are rebuilt from bitsets
+    and everything that is the same for all partial routes is in shared data.
+*/
 template<int Size> struct alignas(64) BruteForceSolutionData {
-    std::vector<std::vector<NodeType>>* adjList;
-    std::vector<std::vector<NodeType>>* revAdjList;
+    BruteForceSharedData<Size>* shared;
     int currentNode;
     int previousLastNonRingNode;
     int lastNonRingNode;
@@ -18,12 +33,8 @@ template<int Size> struct alignas(64) BruteForceSolutionData {
     std::bitset<Size> visited;
     std::bitset<Size> srcNotToConsider;
     std::bitset<Size> prevNotToConsider;
-    std::bitset<Size> isRingCp;
     FixedStackVector<MinInNode, Size> minInNodes;
     FixedStackVector<CompressedEdgeNoPrev, Size> edges;
-    FixedStackVector<NodeType, Size> prevToConsider;
-    FixedStackVector<NodeType, Size> notVisitedNodes;
-    std::array<std::bitset<Size>, Size> possibleInNodes;
 
     int getCost() const {
         return cost + minInSum;
@@ -42,7 +53,19 @@ template<int Size> struct RawBruteForceSolutionData {
     }
 };
 
-template<int Size> void findSolutionsBruteForceLoop(SolutionConfig& config, RawBruteForceSolutionData<Size>& rawSolutionData, PriorityMultiQueue<RawBruteForceSolutionData<Size>>& dataQueue, PreallocatedVector<RawBruteForceSolutionData<Size>>& backlog) {
+template<int Size> uint64_t bruteForceStateKey(const std::bitset<Size>& visited, int curNode, int prevNode, int lastNonRingNode) {
+    uint64_t x = std::hash<std::bitset<Size>>()(visited);
+    x ^= (uint64_t(curNode) | uint64_t(prevNode) << 8 | uint64_t(lastNonRingNode) << 16) * 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/*
+    Without ring CPs there are no respawns, and without sequence dependence every connection takes its time from weights,
+    so the loop is instantiated for each combination and the one matching the map is picked once before the search.
+*/
+template<int Size, bool HasRingCps, bool HasSequenceDependence> void findSolutionsBruteForceLoop(SolutionConfig& config, RawBruteForceSolutionData<Size>& rawSolutionData, PriorityMultiQueue<RawBruteForceSolutionData<Size>>& dataQueue, PreallocatedVector<RawBruteForceSolutionData<Size>>& backlog) {
     do {
         if (!backlog.empty()) {
             rawSolutionData = std::move(backlog.back());
@@ -54,10 +77,12 @@ template<int Size> void findSolutionsBruteForceLoop(SolutionConfig& config, RawB
         if (config.stopWorking())
             return;
 
-        auto& [adjListPtr, revAdjListPtr, curNode, previousLastNonRingNode, lastNonRingNode, cost, minInSum, 
-            visited, srcNotToConsider, prevNotToConsider, isRingCp, minInNodes, edges, prevToConsider, notVisitedNodes, possibleInNodes] = solutionData;
-        auto& adjList = *adjListPtr;
-        auto& revAdjList = *revAdjListPtr;
+        auto& [shared, curNode, previousLastNonRingNode, lastNonRingNode, cost, minInSum, 
+            visited, srcNotToConsider, prevNotToConsider, minInNodes, edges] = solutionData;
+        auto& adjList = shared->adjList;
+        auto& revAdjList = shared->revAdjList;
+        auto& possibleInNodes = shared->possibleInNodes;
+        auto& isRingCp = shared->isRingCp;
 
         minInSum -= minInNodes[curNode].cost;
 
@@ -65,7 +90,8 @@ template<int Size> void findSolutionsBruteForceLoop(SolutionConfig& config, RawB
             continue;
 
         if (edges.size() == config.weights.size() - 1) {
-            std::vector<CompressedEdge> edgesVec(edges.size());
+            thread_local std::vector<CompressedEdge> edgesVec;
+            edgesVec.resize(edges.size());
             for (int i = 0; i < edges.size(); ++i) {
                 edgesVec[i].src = edges[i].src;
                 edgesVec[i].dst = edges[i].dst;
@@ -74,72 +100,104 @@ template<int Size> void findSolutionsBruteForceLoop(SolutionConfig& config, RawB
             continue;
         }
 
-        auto removeNodeIfPossible = [](FixedStackVector<NodeType, Size>& vec, NodeType node) {
-            auto it = std::find(vec.begin(), vec.end(), node);
-            if (it != vec.end()) {
-                *it = vec.back();
-                vec.pop_back();
-            }
-        };
+        visited.set(curNode);
+        FixedStackVector<NodeType, Size> notVisitedNodes;
+        for (int node = 1; node < config.nodeCount(); ++node) {
+            if (!visited.test(node))
+                notVisitedNodes.emplace_back(NodeType(node));
+        }
         auto addSrcNotToConsider = [&](NodeType src) -> bool {
             srcNotToConsider.set(src);
             for (auto dst : notVisitedNodes) {
-                possibleInNodes[dst].reset(src);
-                if (!possibleInNodes[dst].any())
+                if ((possibleInNodes[dst] & ~srcNotToConsider).none())
                     return false;
             }
             return true;
         };
 
-        visited.set(curNode);
-        removeNodeIfPossible(notVisitedNodes, curNode);
+        /*
+            Cost of the rest of the route depends only on visited nodes, current node, its previous node
+            (only if some edge going out of current node is sequence dependent) and last non ring node.
+            If K partial routes with the same state and smaller, distinct costs were already seen, then every
+            completion of this one is beaten by K routes with different times, so it can't get into the top K.
+            It's opt-in, because on maps where states rarely repeat the table only costs time and memory.
+        */
+        auto prevNode = edges.size() >= 1 ? edges.back().src : 0;
+        if (shared->dominanceTable) {
+            auto statePrevNode = HasSequenceDependence && shared->outCostDependsOnPrev[curNode] ? prevNode : NullNode;
+            if (!shared->dominanceTable->insert(bruteForceStateKey<Size>(visited, curNode, statePrevNode, lastNonRingNode), cost))
+                continue;
+        }
 
         if (previousLastNonRingNode != lastNonRingNode) {
             if (!addSrcNotToConsider(previousLastNonRingNode))
                 continue;
         }
-        if (edges.size() > 0 && isRingCp.test(edges.back().src)) {
+        if (HasRingCps && edges.size() > 0 && isRingCp.test(edges.back().src)) {
             if (!addSrcNotToConsider(edges.back().src))
                 continue;
         } else if (edges.size() >= 2 && edges.back().src != edges[edges.size() - 2].dst) {
             if (!addSrcNotToConsider(edges[edges.size() - 2].dst))
                 continue;
         }
-        
-        if (previousLastNonRingNode != lastNonRingNode) {
-            if (edges.size() <= 0 || edges.back().src != previousLastNonRingNode) {
-                prevNotToConsider.set(previousLastNonRingNode);
-                removeNodeIfPossible(prevToConsider, previousLastNonRingNode);
+
+        FixedStackVector<NodeType, Size> prevToConsider;
+        alignas(32) int32_t prevMask[Size + 8];
+        if constexpr (HasSequenceDependence) {
+            if (previousLastNonRingNode != lastNonRingNode) {
+                if (edges.size() <= 0 || edges.back().src != previousLastNonRingNode) {
+                    prevNotToConsider.set(previousLastNonRingNode);
+                }
+            }
+            if (edges.size() >= 2 && edges[edges.size() - 2].src != lastNonRingNode) {
+                prevNotToConsider.set(edges[edges.size() - 2].src);
+            }
+            if (edges.size() >= 2 && edges.back().src != edges[edges.size() - 2].dst) {
+                prevNotToConsider.set(edges[edges.size() - 2].dst);
+            }
+            for (int prev = 0; prev < shared->prevStride; ++prev) {
+                bool toConsider = prev < config.condWeights[0][0].size() && !prevNotToConsider.test(prev);
+                prevMask[prev] = toConsider ? 0 : -1;
+                if (toConsider)
+                    prevToConsider.emplace_back(NodeType(prev));
             }
-        }
-        if (edges.size() >= 2 && edges[edges.size() - 2].src != lastNonRingNode) {
-            prevNotToConsider.set(edges[edges.size() - 2].src);
-            removeNodeIfPossible(prevToConsider, edges[edges.size() - 2].src);
-        }
-        if (edges.size() >= 2 && edges.back().src != edges[edges.size() - 2].dst) {
-            prevNotToConsider.set(edges[edges.size() - 2].dst);
-            removeNodeIfPossible(prevToConsider, edges[edges.size() - 2].dst);
         }
 
         for (auto dst : notVisitedNodes) {
             auto& min = minInNodes[dst];
-            bool needToRecalculate = prevNotToConsider.test(min.prev) || srcNotToConsider.test(min.src);
+            bool needToRecalculate = srcNotToConsider.test(min.src) || (HasSequenceDependence && prevNotToConsider.test(min.prev));
             if (!needToRecalculate)
                 continue;
             minInSum -= min.cost;
             min.src = -1;
             min.cost = config.limit();
-            auto& condWeightsDst = config.condWeights[dst];
-            for (int src : revAdjList[dst]) {
-                auto& condWeightsDstSrc = condWeightsDst[src];
-                if (srcNotToConsider.test(src))
-                    continue;
-                for (auto prev : prevToConsider) {
-                    auto value = condWeightsDstSrc[prev];
-                    if (value < min.cost) {
+            if constexpr (HasSequenceDependence) {
+                auto inCostsDst = &shared->inCostsByPrev[dst * config.nodeCount() * shared->prevStride];
+                MaskedMinimum minInCost;
+                for (int src : revAdjList[dst]) {
+                    if (!srcNotToConsider.test(src))
+                        minInCost.add(&inCostsDst[src * shared->prevStride], prevMask, shared->prevStride);
+                }
+                auto value = minInCost.get();
+                for (int src : revAdjList[dst]) {
+                    if (value >= min.cost)
+                        break;
+                    if (srcNotToConsider.test(src))
+                        continue;
+                    auto inCosts = &inCostsDst[src * shared->prevStride];
+                    auto it = std::find_if(prevToConsider.begin(), prevToConsider.end(), [&](auto prev) { return inCosts[prev] == value; });
+                    if (it != prevToConsider.end()) {
                         min.cost = value;
                         min.src = src;
-                        min.prev = prev;
+                        min.prev = *it;
+                    }
+                }
+            } else {
+                auto& weightsDst = config.weights[dst];
+                for (int src : revAdjList[dst]) {
+                    if (!srcNotToConsider.test(src) && weightsDst[src] < min.cost) {
+                        min.cost = weightsDst[src];
+                        min.src = src;
                     }
                 }
             }
@@ -165,14 +223,14 @@ template<int Size> void findSolutionsBruteForceLoop(SolutionConfig& config, RawB
 
         FixedStackVector<NextNode, 256> nextNodes;
         for (auto nextNode : adjList[curNode]) {
-            auto time = config.condWeights[nextNode][curNode][edges.size() >= 1 ? edges[edges.size() - 1].src : 0];
+            auto time = HasSequenceDependence ? config.condWeights[nextNode][curNode][prevNode] : config.weights[nextNode][curNode];
             if (visited.test(nextNode) || time >= config.ignoredValue)
                 continue;
             if (nextNode == adjList.size() - 1 && edges.size() != config.weights.size() - 2)
                 continue;
             nextNodes.emplace_back(NextNode{ nextNode, false, time });
         }
-        if (curNode != lastNonRingNode) {
+        if (HasRingCps && curNode != lastNonRingNode) {
             for (auto nextNode : adjList[lastNonRingNode]) {
                 auto time = config.condWeights.withRespawn(nextNode, lastNonRingNode);
                 if (visited.test(nextNode) || time >= config.ignoredValue)
@@ -182,15 +240,20 @@ template<int Size> void findSolutionsBruteForceLoop(SolutionConfig& config, RawB
                 nextNodes.emplace_back(NextNode{ nextNode, true, time });
             }
         }
-        if (dataQueue.isAlmostFull()) {
+        /*
+            Routes that visited at least half of the CPs are finished depth first even if there is still space in the queue.
+            Before the limit gets tight most of them would only be pushed to be pruned when popped, and with the queue
+            taking up a few GB each push and pop misses the cache.
+        */
+        bool isDeepRoute = edges.size() * 2 >= config.nodeCount();
+        if (isDeepRoute || dataQueue.isAlmostFull()) {
             std::sort(nextNodes.begin(), nextNodes.end());
         }
         for (auto [nextNode, isRespawn, diff] : nextNodes) {
             auto srcNode = isRespawn ? lastNonRingNode : curNode;
             edges.emplace_back(CompressedEdgeNoPrev{ NodeType(srcNode), NodeType(nextNode) });
-            int newLastNonRingNode = isRingCp.test(nextNode) ? lastNonRingNode : nextNode;
-            auto queueIsAlmostFull = dataQueue.isAlmostFull();
-            if (dataQueue.isAlmostFull()) {
+            int newLastNonRingNode = HasRingCps && isRingCp.test(nextNode) ? lastNonRingNode : nextNode;
+            if (isDeepRoute || dataQueue.isAlmostFull()) {
                 auto& newData = backlog.emplace_back(std::move(rawSolutionData)).asData();
                 newData.currentNode = nextNode;
                 newData.previousLastNonRingNode = lastNonRingNode;
@@ -210,7 +273,7 @@ template<int Size> void findSolutionsBruteForceLoop(SolutionConfig& config, RawB
     } while (!backlog.empty());
 }
 
-template<int Size> void findSolutionsBruteForce(SolutionConfig& config) {
+template<int Size> void findSolutionsBruteForce(SolutionConfig& config, bool pruneRepeatedPartialRoutes) {
     RawBruteForceSolutionData<Size> rawSolutionData;
     BruteForceSolutionData<Size>& solutionData = rawSolutionData.asData();
 
@@ -222,16 +285,14 @@ template<int Size> void findSolutionsBruteForce(SolutionConfig& config) {
     solutionData.visited = std::bitset<Size>();
     solutionData.srcNotToConsider = std::bitset<Size>();
     solutionData.prevNotToConsider = std::bitset<Size>();
-    solutionData.isRingCp = std::bitset<Size>();
     solutionData.minInNodes = FixedStackVector<MinInNode, Size>();
     solutionData.edges = FixedStackVector<CompressedEdgeNoPrev, Size>();
-    solutionData.prevToConsider = FixedStackVector<NodeType, Size>();
-    solutionData.notVisitedNodes = FixedStackVector<NodeType, Size>();
-    solutionData.possibleInNodes = std::array<std::bitset<Size>, Size>();
     auto& edges = solutionData.edges;
     auto& visited = solutionData.visited;
 
-    std::vector<std::vector<NodeType>> adjList(config.weights.size());
+    BruteForceSharedData<Size> shared{ {}, {}, {}, {}, {}, 0, {}, nullptr };
+    auto& adjList = shared.adjList;
+    adjList.resize(config.weights.size());
     for (int i = 0; i < adjList.size(); ++i) {
         for (int j = 0; j < adjList.size(); ++j) {
             if (config.weights[j][i] < config.ignoredValue) {
@@ -240,18 +301,57 @@ template<int Size> void findSolutionsBruteForce(SolutionConfig& config) {
         }
         std::sort(adjList[i].begin(), adjList[i].end(), [&](int a, int b) { return config.weights[a][i] < config.weights[b][i]; });
     }
-    std::vector<std::vector<NodeType>> revAdjList(config.weights.size());
+    auto& revAdjList = shared.revAdjList;
+    revAdjList.resize(config.weights.size());
     for (int i = 0; i < adjList.size(); ++i) {
         for (int j : adjList[i]) {
             revAdjList[j].push_back(i);
         }
     }
-    solutionData.adjList = &adjList;
-    solutionData.revAdjList = &revAdjList;
+    auto& outCostDependsOnPrev = shared.outCostDependsOnPrev;
+    outCostDependsOnPrev.resize(config.weights.size(), false);
+    for (int src = 0; src < adjList.size(); ++src) {
+        for (int dst : adjList[src]) {
+            auto& condWeightsDstSrc = config.condWeights[dst][src];
+            for (int prev = 0; prev < config.nodeCount(); ++prev) {
+                if (prev != src && prev != dst && condWeightsDstSrc[prev] != config.weights[dst][src])
+                    outCostDependsOnPrev[src] = true;
+            }
+        }
+    }
+    // respawn clause faster than the connection itself also counts, as then weights isn't the time of the connection
+    bool hasSequenceDependence = false;
+    for (int src = 0; src < adjList.size(); ++src) {
+        for (int dst : adjList[src]) {
+            auto& condWeightsDstSrc = config.condWeights[dst][src];
+            for (int prev = 0; prev < config.nodeCount(); ++prev) {
+                if (condWeightsDstSrc[prev] != config.weights[dst][src])
+                    hasSequenceDependence = true;
+            }
+        }
+    }
+    shared.prevStride = (int(config.condWeights[0][0].size()) + 7) / 8 * 8;
+    if (hasSequenceDependence) {
+        shared.inCostsByPrev.resize(config.nodeCount() * config.nodeCount() * shared.prevStride, INT_MAX);
+        for (int dst = 0; dst < config.nodeCount(); ++dst) {
+            for (int src = 0; src < config.nodeCount(); ++src) {
+                std::copy(config.condWeights[dst][src].begin(), config.condWeights[dst][src].end(), &shared.inCostsByPrev[(dst * config.nodeCount() + src) * shared.prevStride]);
+            }
+        }
+    }
+    if (pruneRepeatedPartialRoutes) {
+        // room for every visited set and current node (and previous node if it matters), but no more than 1GB
+        constexpr std::size_t MaxDominanceTableMemory = 1'000'000'000;
+        auto stateCount = (uint64_t(1) << std::min(config.nodeCount() - 1, 30)) * config.nodeCount() * (hasSequenceDependence ? config.nodeCount() : 1);
+        auto memory = std::min<uint64_t>(MaxDominanceTableMemory, stateCount * KBestCostTable::MemoryPerKey(config.maxSolutionCount));
+        shared.dominanceTable = std::make_unique<KBestCostTable>(config.maxSolutionCount, memory);
+    }
+    solutionData.shared = &shared;
 
+    shared.possibleInNodes.resize(revAdjList.size());
     for (int dst = 0; dst < revAdjList.size(); ++dst) {
         for (int src : revAdjList[dst]) {
-            solutionData.possibleInNodes[dst].set(src);
+            shared.possibleInNodes[dst].set(src);
         }
     }
 
@@ -276,29 +376,31 @@ template<int Size> void findSolutionsBruteForce(SolutionConfig& config) {
         solutionData.minInSum += min.cost;
     }
 
-    for (int i = 0; i < config.condWeights[0][0].size(); ++i) {
-        solutionData.prevToConsider.emplace_back(i);
-    }
-    for (int i = 1; i < config.weights.size(); ++i) {
-        solutionData.notVisitedNodes.emplace_back(i);
-    }
     visited.set(0);
     for (auto ringCp : config.ringCps) {
-        solutionData.isRingCp.set(ringCp);
+        shared.isRingCp.set(ringCp);
     }
 
-    findSolutionsBfs<RawBruteForceSolutionData<Size>>(config, rawSolutionData, sizeof(RawBruteForceSolutionData<Size>), findSolutionsBruteForceLoop<Size>);
+    auto findSolutionsLoop = findSolutionsBruteForceLoop<Size, true, true>;
+    if (config.ringCps.empty() && !hasSequenceDependence) {
+        findSolutionsLoop = findSolutionsBruteForceLoop<Size, false, false>;
+    } else if (config.ringCps.empty()) {
+        findSolutionsLoop = findSolutionsBruteForceLoop<Size, false, true>;
+    } else if (!hasSequenceDependence) {
+        findSolutionsLoop = findSolutionsBruteForceLoop<Size, true, false>;
+    }
+    findSolutionsBfs<RawBruteForceSolutionData<Size>>(config, rawSolutionData, sizeof(RawBruteForceSolutionData<Size>), findSolutionsLoop);
 }
 
-void findSolutionsBruteForce(SolutionConfig& config) {
+void findSolutionsBruteForce(SolutionConfig& config, bool pruneRepeatedPartialRoutes) {
     if (config.nodeCount() <= 24) {
-        findSolutionsBruteForce<26>(config);
+        findSolutionsBruteForce<26>(config, pruneRepeatedPartialRoutes);
     } else if (config.nodeCount() <= 40) {
-        findSolutionsBruteForce<42>(config);
+        findSolutionsBruteForce<42>(config, pruneRepeatedPartialRoutes);
     } else if (config.nodeCount() <= 102) {
-        findSolutionsBruteForce<104>(config);
+        findSolutionsBruteForce<104>(config, pruneRepeatedPartialRoutes);
     } else {
-        findSolutionsBruteForce<256>(config);
+        findSolutionsBruteForce<256>(config, pruneRepeatedPartialRoutes);
     }
 }
 
@@ -3,6 +3,7 @@
 #include <string>
 #include <cstdint>
 #include <filesystem>
+#include <unordered_set>
 #include <boost/int128.hpp>
 #include "utility.h"
 
@@ -20,6 +21,8 @@ struct ConnectionFinderSettings {
     char searchSourceNodes[1024] = { 0 };
 };
 
+enum class KickAcceptance { BetterOnly, Threshold, Annealing };
+
 struct InputData {
     // general
     int fontSize = 16;
@@ -33,6 +36,13 @@ struct InputData {
     bool allowRepeatCpsForFilledConnections = true;
     int maxRepeatNodesToAdd = 100'000;
     char turnedOffRepeatNodes[1024] = { 0 };
+    bool emitRoutesInProvenOrder = false;
+    bool pruneRepeatedPartialRoutes = false;
+    bool streamRoutesToLog = false;
+    int heuristicCandidateCount = 8;
+    bool heuristicIteratedKicks = true;
+    KickAcceptance heuristicKickAcceptance = KickAcceptance::Threshold;
+    int heuristicKickAcceptanceTime = 1;
 
     char outputDataFile[1024] = { 0 };
     char ringCps[1024] = { 0 };
@@ -75,6 +85,13 @@ struct InputData {
         file << "allowRepeatCpsForFilledConnections" << allowRepeatCpsForFilledConnections << '\n';
         file << "maxRepeatNodesToAdd " << maxRepeatNodesToAdd << '\n';
         file << "turnedOffRepeatNodes " << turnedOffRepeatNodes << '\n';
+        file << "emitRoutesInProvenOrder " << emitRoutesInProvenOrder << '\n';
+        file << "pruneRepeatedPartialRoutes " << pruneRepeatedPartialRoutes << '\n';
+        file << "streamRoutesToLog " << streamRoutesToLog << '\n';
+        file << "heuristicCandidateCount " << heuristicCandidateCount << '\n';
+        file << "heuristicIteratedKicks " << heuristicIteratedKicks << '\n';
+        file << "heuristicKickAcceptance " << int(heuristicKickAcceptance) << '\n';
+        file << "heuristicKickAcceptanceTime " << heuristicKickAcceptanceTime << '\n';
 
         file << "outputDataFile " << outputDataFile << '\n';
         file << "ringCps " << ringCps << '\n';
@@ -125,6 +142,22 @@ struct InputData {
                 maxRepeatNodesToAdd = stoi(value);
             } else if (key == "turnedOffRepeatNodes") {
                 strcpy(turnedOffRepeatNodes, value.c_str() + 1);
+            } else if (key == "emitRoutesInProvenOrder") {
+                emitRoutesInProvenOrder = stoi(value);
+            } else if (key == "pruneRepeatedPartialRoutes") {
+                pruneRepeatedPartialRoutes = stoi(value);
+            } else if (key == "streamRoutesToLog") {
+                streamRoutesToLog = stoi(value);
+            } else if (key == "heuristicCandidateCount") {
+                heuristicCandidateCount = stoi(value);
+            } else if (key == "heuristicIteratedKicks") {
+                heuristicIteratedKicks = stoi(value);
+            } else if (key == "heuristicKickAcceptance") {
+                int kickAcceptance = stoi(value);
+                if (kickAcceptance >= int(KickAcceptance::BetterOnly) && kickAcceptance <= int(KickAcceptance::Annealing))
+                    heuristicKickAcceptance = KickAcceptance(kickAcceptance);
+            } else if (key == "heuristicKickAcceptanceTime") {
+                heuristicKickAcceptanceTime = stoi(value);
             } else if (key == "outputDataFile") {
                 strcpy(outputDataFile, value.c_str() + 1);
             } else if (key == "ringCps") {
@@ -190,7 +223,7 @@ constexpr NodeType NullNode = NodeType(-1);
 constexpr Edge NullEdge = { NullNode, NullNode };
 constexpr EdgeCostType Inf = 100'000'000;
 
-enum class Algorithm { None, Assignment, Arborescence, BruteForce, LinKernighan };
+enum class Algorithm { None, Assignment, Arborescence, BruteForce, LinKernighan, DynamicProgramming };
 
 using RepeatNodesVector = FastSmallVector<NodeType, 5>;
 
@@ -286,14 +319,14 @@ bool operator<(const std::vector<SolutionEdge>& a, const std::vector<SolutionEdg
 }
 
 struct BestSolution {
-    BestSolution() : solutionConnections(0) {}
-    BestSolution(const SolutionVariation& solution, const SolutionVariation& sortedSolution, const std::vector<CompressedEdge>& compressedVariation, const FastSet2d& solutionConnections, const std::vector<std::array<int16_t, 3>>& unverifiedConnections, const std::string& solutionString, Edge addedConnection, int time) :
-        compressedVariation(compressedVariation), solutionConnections(solutionConnections), unverifiedConnections(unverifiedConnections), solutionString(solutionString), addedConnection(addedConnection), time(time)
+    BestSolution() {}
+    BestSolution(SolutionVariation solution, SolutionVariation sortedSolution, std::vector<CompressedEdge> compressedVariation, std::vector<std::array<int16_t, 3>> unverifiedConnections, std::string solutionString, Edge addedConnection, int time) :
+        compressedVariation(std::move(compressedVariation)), unverifiedConnections(std::move(unverifiedConnections)), solutionString(std::move(solutionString)), addedConnection(addedConnection), time(time)
     {
         if (!sortedSolution.solution.empty()) {
-            variations.push_back(sortedSolution);
+            variations.push_back(std::move(sortedSolution));
         }
-        variations.push_back(solution);
+        variations.push_back(std::move(solution));
     }
     const std::vector<SolutionEdge>& solution() const {
         if (empty())
@@ -305,6 +338,13 @@ struct BestSolution {
             return {};
         return variations[0].compressedSolution;
     }
+    // connections used by the route (including repeat CPs) - not stored since it's N^2 bits per route and only filtering needs it
+    FastSet2d connectionsSet(int nodeCount) const {
+        FastSet2d result(nodeCount);
+        for (auto edge : compressedVariation)
+            result.set(edge.dst, edge.src);
+        return result;
+    }
     void clear() {
         compressedVariation.clear();
         variations.clear();
@@ -318,7 +358,6 @@ struct BestSolution {
     std::vector<SolutionVariation> variations;
     std::vector<std::array<int16_t, 3>> unverifiedConnections;
     std::string solutionString;
-    FastSet2d solutionConnections;
     Edge addedConnection;
     int time;
 };
@@ -329,6 +368,62 @@ bool operator!=(const BestSolution& a, const BestSolution& b) {
     return !(a == b);
 }
 
+uint64_t solutionFingerprint(int time, const std::vector<CompressedEdge>& compressedVariation, const std::vector<CompressedEdge>& compressedSolution) {
+    auto mix = [](uint64_t x) {
+        x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27; x *= 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    };
+    uint64_t hash = mix(time);
+    for (auto& edges : { &compressedVariation, &compressedSolution }) {
+        hash = mix(hash ^ edges->size());
+        for (auto edge : *edges) {
+            hash = mix(hash ^ ((uint64_t(edge.prev) << 16) | (uint64_t(edge.src) << 8) | edge.dst));
+        }
+    }
+    return hash;
+}
+
+/*
+    Fingerprints of routes that are currently in bestSolutions (removed again when the route is evicted,
+    so the set never grows past maxSolutionCount routes with their variations).
+    Split into shards with separate locks, so that threads that keep finding the same
+    routes can reject them without waiting on solutionUpdateMutex.
+*/
+struct SolutionFingerprints {
+    static constexpr int ShardCount = 64;
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_set<uint64_t> fingerprints;
+    };
+    std::array<Shard, ShardCount> shards;
+
+    Shard& shard(uint64_t fingerprint) {
+        return shards[fingerprint >> 58];
+    }
+    bool contains(uint64_t fingerprint) {
+        auto& s = shard(fingerprint);
+        std::scoped_lock l{ s.mutex };
+        return s.fingerprints.contains(fingerprint);
+    }
+    void insert(uint64_t fingerprint) {
+        auto& s = shard(fingerprint);
+        std::scoped_lock l{ s.mutex };
+        s.fingerprints.insert(fingerprint);
+    }
+    void erase(uint64_t fingerprint) {
+        auto& s = shard(fingerprint);
+        std::scoped_lock l{ s.mutex };
+        s.fingerprints.erase(fingerprint);
+    }
+    void clear() {
+        for (auto& s : shards) {
+            std::scoped_lock l{ s.mutex };
+            s.fingerprints.clear();
+        }
+    }
+};
+
 struct SolutionConfig {
     std::vector<std::vector<int>> weights;
     ConditionalMatrix<int> condWeights;
@@ -337,9 +432,11 @@ struct SolutionConfig {
     std::atomic<int>* limit_;
     int ignoredValue;
     bool useExtendedMatrix;
-    ThreadSafeVec<BestSolution> solutionsVec;
+    CursorLog<BestSolution> solutionsVec; // every accepted route, kept only until all readers saw it
     std::vector<BestSolution> bestSolutions;
+    SolutionFingerprints solutionFingerprints; // not copied - it only speeds up rejecting repeated routes
     std::string outputFileName;
+    BackgroundFileWriter* solutionsLog = nullptr; // not copied - only the main search streams routes
     RepeatNodeMatrix repeatNodeMatrix;
     Vector3d<Bool> useRespawnMatrix;
     std::vector<int> ringCps;
@@ -382,6 +479,10 @@ struct SolutionConfig {
     int limit() const {
         return limit_->load();
     }
+    void clearBestSolutions() {
+        bestSolutions.clear();
+        solutionFingerprints.clear();
+    }
 
     std::string partialSolutionCountString() {
         return boost::int128::to_string(partialSolutionCount.load());
@@ -0,0 +1,429 @@
+#pragma once
+#include "solutionFinderCommon.h"
+#include "utility.h"
+#include "common.h"
+
+/*
+    Exact Held-Karp style solver for small maps.
+    State of a partial route is (set of visited CPs, current CP, previous CP, last non ring CP), but previous CP
+    only matters for CPs with sequence dependent outgoing connections and last non ring CP only for ring CPs,
+    so on most maps there are just a few states per (set of visited CPs, current CP).
+    For every state the table holds exact time needed to finish the route from it. Table is filled layer by layer,
+    from all CPs visited down to the start, with sets of visited CPs of the same size split between threads.
+
+    Top K routes are then enumerated with best first search over partial routes ordered by their time so far
+    plus exact time to finish - every complete route that gets popped is the next best one, so apart from
+    the top K routes themselves only their direct neighbours are ever created.
+
+    On bigger maps the search meets in the middle - the table is kept only for sets with at least junctionLayer
+    visited CPs (backward halves of routes going into the finish) and the first CPs of routes are enumerated forward
+    from the start with a lower bound instead of exact time to finish. Forward half is joined with the backward one
+    by a single connection, and the state it leads to keeps the previous CP so sequence dependence is still exact.
+*/
+
+struct DynamicProgrammingStates {
+    /*
+        Previous CPs are grouped into classes - two previous CPs are in the same class if every connection going out
+        of the current CP takes the same time after both of them. Usually there are only one or two classes.
+    */
+    int nodeCount;
+    std::vector<int> prevClass; // [node * nodeCount + prev]
+    std::vector<int> prevClassCount;
+    std::vector<Bool> isRingCp;
+    std::vector<int> firstIndex; // [node * nodeCount + prev] - index of the state with last non ring CP 0
+    int count = 0;
+
+    DynamicProgrammingStates(const SolutionConfig& config) : nodeCount(config.nodeCount()), prevClass(config.nodeCount() * config.nodeCount(), 0), prevClassCount(config.nodeCount(), 0), isRingCp(config.nodeCount(), false), firstIndex(config.nodeCount() * config.nodeCount(), 0) {
+        for (auto ringCp : config.ringCps) {
+            isRingCp[ringCp] = true;
+        }
+        for (int node = 0; node < nodeCount; ++node) {
+            // connection to a CP can't be taken if it was visited before, so its time after the previous CP doesn't matter
+            auto haveSameOutTimes = [&](int prev1, int prev2) {
+                for (int next = 0; next < nodeCount; ++next) {
+                    if (next == prev1 || next == prev2 || next == node || config.weights[next][node] >= config.ignoredValue)
+                        continue;
+                    if (config.condWeights[next][node][prev1] != config.condWeights[next][node][prev2])
+                        return false;
+                }
+                return true;
+            };
+            std::vector<std::vector<int>> classes;
+            for (int prev = 0; prev < nodeCount; ++prev) {
+                auto it = std::find_if(classes.begin(), classes.end(), [&](auto& prevs) {
+                    return std::all_of(prevs.begin(), prevs.end(), [&](int other) { return haveSameOutTimes(prev, other); });
+                });
+                prevClass[node * nodeCount + prev] = int(it - classes.begin());
+                if (it == classes.end())
+                    classes.push_back({ prev });
+                else
+                    it->push_back(prev);
+            }
+            prevClassCount[node] = int(classes.size());
+            int lastNonRingNodeCount = isRingCp[node] ? nodeCount : 1;
+            for (int prev = 0; prev < nodeCount; ++prev) {
+                firstIndex[node * nodeCount + prev] = count + prevClass[node * nodeCount + prev] * lastNonRingNodeCount;
+            }
+            count += prevClassCount[node] * lastNonRingNodeCount;
+        }
+    }
+
+    int index(int node, int prev, int lastNonRingNode) const {
+        return firstIndex[node * nodeCount + prev] + (isRingCp[node] ? lastNonRingNode : 0);
+    }
+};
+
+void findSolutionsDynamicProgramming(SolutionConfig& config, State& state) {
+    const std::size_t MaxTableMemory = 2'000'000'000;
+    const uint64_t MaxStoredSetCount = 1 << 16;
+    const int MaxRelaxedCpCount = 18;
+    const uint64_t MaskBlockSize = 1024;
+#ifdef DEBUG
+    const int ThreadCount = 1;
+#else
+    const int ThreadCount = (std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 1;
+#endif
+
+    int n = config.nodeCount();
+    int cpCount = n - 2; // bit (i - 1) of visited mask is CP i, start and finish are implicit
+    if (cpCount > DynamicProgrammingMaxCpCount) // runAlgorithm reports an error instead of starting it
+        return;
+    DynamicProgrammingStates states(config);
+    uint64_t fullMask = (uint64_t(1) << cpCount) - 1;
+
+    uint64_t binomial[31][31] = {};
+    for (int i = 0; i <= 30; ++i) {
+        binomial[i][0] = 1;
+        for (int j = 1; j <= i; ++j) {
+            binomial[i][j] = binomial[i - 1][j - 1] + (j < i ? binomial[i - 1][j] : 0);
+        }
+    }
+    // smallest number of visited CPs for which sets are still stored, with all sets stored the table is indexed directly by mask
+    int junctionLayer = 0;
+    std::vector<uint64_t> layerStart(cpCount + 2, 0);
+    while (true) {
+        for (int layer = cpCount; layer >= junctionLayer; --layer) {
+            layerStart[layer] = layerStart[layer + 1] + binomial[cpCount][layer];
+        }
+        if ((layerStart[junctionLayer] <= MaxStoredSetCount && sizeof(EdgeCostType) * states.count * layerStart[junctionLayer] <= MaxTableMemory) || junctionLayer == cpCount)
+            break;
+        junctionLayer += 1;
+    }
+    uint64_t storedSetCount = layerStart[junctionLayer];
+    for (int layer = junctionLayer; layer <= cpCount; ++layer) {
+        layerStart[layer] = storedSetCount - layerStart[layer];
+    }
+    std::vector<EdgeCostType> timeToFinish((junctionLayer == 0 ? fullMask + 1 : storedSetCount) * states.count, Inf);
+
+    /*
+        Sets of the same size are ordered by their rank in combinatorial number system (sum of C(i-th CP, i)), which is
+        looked up in tables for 10 bit chunks of the mask, indexed by [(chunk * 31 + CPs in lower chunks) * 1024 + chunk bits].
+    */
+    const int ChunkBits = 10;
+    const int ChunkCount = 3;
+    std::vector<uint32_t> chunkRank;
+    if (junctionLayer > 0) {
+        chunkRank.resize(ChunkCount * 31 << ChunkBits, 0);
+        for (int chunk = 0; chunk < ChunkCount; ++chunk) {
+            for (int lowerCount = 0; lowerCount <= 30; ++lowerCount) {
+                for (int bits = 0; bits < (1 << ChunkBits); ++bits) {
+                    uint64_t rank = 0;
+                    int count = lowerCount;
+                    for (int i = 0; i < ChunkBits; ++i) {
+                        if (!(bits & (1 << i)))
+                            continue;
+                        count += 1;
+                        int cp = chunk * ChunkBits + i;
+                        if (count <= 30 && count <= cp)
+                            rank += binomial[cp][count];
+                    }
+                    chunkRank[((chunk * 31 + lowerCount) << ChunkBits) + bits] = uint32_t(rank);
+                }
+            }
+        }
+    }
+    auto tableIndex = [&](uint64_t mask) -> uint64_t {
+        if (junctionLayer == 0)
+            return mask * states.count;
+        uint64_t rank = 0;
+        int count = 0;
+        for (int chunk = 0; chunk < ChunkCount; ++chunk) {
+            int bits = int(mask >> (chunk * ChunkBits)) & ((1 << ChunkBits) - 1);
+            rank += chunkRank[((chunk * 31 + count) << ChunkBits) + bits];
+            count += int(std::bitset<ChunkBits>(bits).count());
+        }
+        return (layerStart[count] + rank) * states.count;
+    };
+
+    // connection times in flat arrays, indexed by [(src * n + prev) * n + dst] and [src * n + dst], Inf if connection can't be used
+    std::vector<EdgeCostType> outTimes(n * n * n, Inf);
+    std::vector<EdgeCostType> respawnOutTimes(n * n, Inf);
+    for (int src = 0; src < n; ++src) {
+        for (int dst = 0; dst < n; ++dst) {
+            if (config.weights[dst][src] >= config.ignoredValue)
+                continue;
+            for (int prev = 0; prev < n; ++prev) {
+                auto time = config.condWeights[dst][src][prev];
+                outTimes[(src * n + prev) * n + dst] = time >= config.ignoredValue ? Inf : time;
+            }
+            auto time = config.condWeights.withRespawn(dst, src);
+            respawnOutTimes[src * n + dst] = time >= config.ignoredValue ? Inf : time;
+        }
+    }
+    auto edgeCost = [&](int dst, int src, int prev) {
+        return outTimes[(src * n + prev) * n + dst];
+    };
+    auto respawnCost = [&](int dst, int src) {
+        return respawnOutTimes[src * n + dst];
+    };
+
+    /*
+        Lower bound of time to finish for sets below junction layer comes from the same problem relaxed to only
+        MaxRelaxedCpCount CPs with the slowest connections into them. Other CPs can be skipped or visited any number
+        of times, every connection takes its fastest time and respawn on a ring CP can go back to any CP.
+    */
+    std::vector<EdgeCostType> minInTime(n, Inf);
+    std::vector<EdgeCostType> minPathTime(n * n, Inf); // [src * n + dst]
+    for (int src = 0; src < n; ++src) {
+        minPathTime[src * n + src] = 0;
+        for (int dst = 1; dst < n; ++dst) {
+            if (dst == src)
+                continue;
+            auto& time = minPathTime[src * n + dst];
+            for (int prev = 0; prev < n; ++prev) {
+                time = std::min(time, edgeCost(dst, src, prev));
+            }
+            for (int respawnSrc = 0; respawnSrc < n && states.isRingCp[src]; ++respawnSrc) {
+                time = std::min(time, respawnCost(dst, respawnSrc));
+            }
+            minInTime[dst] = std::min(minInTime[dst], time);
+        }
+    }
+    for (int mid = 0; mid < n - 1; ++mid) {
+        for (int src = 0; src < n; ++src) {
+            for (int dst = 0; dst < n; ++dst) {
+                minPathTime[src * n + dst] = std::min(minPathTime[src * n + dst], std::min<EdgeCostType>(Inf, minPathTime[src * n + mid] + minPathTime[mid * n + dst]));
+            }
+        }
+    }
+    std::vector<int> boundCps;
+    for (int cp = 1; cp < n - 1 && junctionLayer > 0; ++cp) {
+        boundCps.push_back(cp);
+    }
+    std::sort(boundCps.begin(), boundCps.end(), [&](int a, int b) { return minInTime[a] > minInTime[b]; });
+    boundCps.resize(std::min<int>(boundCps.size(), MaxRelaxedCpCount));
+    uint64_t fullBoundMask = (uint64_t(1) << boundCps.size()) - 1;
+    std::vector<EdgeCostType> relaxedTimeToFinish(junctionLayer > 0 ? (fullBoundMask + 1) * n : 0, Inf); // [bound mask * n + node]
+    for (uint64_t boundMask = fullBoundMask + 1; boundMask-- > 0 && junctionLayer > 0;) {
+        for (int node = 0; node < n - 1; ++node) {
+            auto& time = relaxedTimeToFinish[boundMask * n + node];
+            if (boundMask == fullBoundMask) {
+                time = minPathTime[node * n + n - 1];
+                continue;
+            }
+            for (int i = 0; i < int(boundCps.size()); ++i) {
+                if (!(boundMask & (uint64_t(1) << i)))
+                    time = std::min(time, std::min<EdgeCostType>(Inf, minPathTime[node * n + boundCps[i]] + relaxedTimeToFinish[(boundMask | (uint64_t(1) << i)) * n + boundCps[i]]));
+            }
+        }
+    }
+    auto timeToFinishLowerBound = [&](uint64_t mask, int node) {
+        EdgeCostType minInTimeSum = minInTime[n - 1];
+        for (int cp = 1; cp < n - 1; ++cp) {
+            if (!(mask & (uint64_t(1) << (cp - 1))))
+                minInTimeSum = std::min<EdgeCostType>(Inf, minInTimeSum + minInTime[cp]);
+        }
+        uint64_t boundMask = 0;
+        for (int i = 0; i < int(boundCps.size()); ++i) {
+            if (mask & (uint64_t(1) << (boundCps[i] - 1)))
+                boundMask |= uint64_t(1) << i;
+        }
+        return std::max(minInTimeSum, relaxedTimeToFinish[boundMask * n + node]);
+    };
+    auto forEachNextState = [&](uint64_t mask, int node, int prev, int lastNonRingNode, auto&& callback) {
+        auto tryNext = [&](int nextNode, int srcNode, EdgeCostType cost) {
+            if (cost >= Inf)
+                return;
+            if (nextNode == n - 1) {
+                callback(nextNode, srcNode, cost, Inf);
+                return;
+            }
+            auto nextMask = mask | (uint64_t(1) << (nextNode - 1));
+            int nextLastNonRingNode = states.isRingCp[nextNode] ? lastNonRingNode : nextNode;
+            EdgeCostType nextTimeToFinish;
+            if (int(std::bitset<32>(nextMask).count()) >= junctionLayer)
+                nextTimeToFinish = timeToFinish[tableIndex(nextMask) + states.index(nextNode, srcNode, nextLastNonRingNode)];
+            else
+                nextTimeToFinish = timeToFinishLowerBound(nextMask, nextNode);
+            if (nextTimeToFinish < Inf)
+                callback(nextNode, srcNode, cost, nextTimeToFinish);
+        };
+        if (mask == fullMask) {
+            tryNext(n - 1, node, edgeCost(n - 1, node, prev));
+            if (node != lastNonRingNode)
+                tryNext(n - 1, lastNonRingNode, respawnCost(n - 1, lastNonRingNode));
+            return;
+        }
+        for (int nextNode = 1; nextNode < n - 1; ++nextNode) {
+            if (mask & (uint64_t(1) << (nextNode - 1)))
+                continue;
+            tryNext(nextNode, node, edgeCost(nextNode, node, prev));
+            if (node != lastNonRingNode)
+                tryNext(nextNode, lastNonRingNode, respawnCost(nextNode, lastNonRingNode));
+        }
+    };
+    auto calculateTimeToFinish = [&](uint64_t mask, int node, int prev, int lastNonRingNode) {
+        EdgeCostType bestTime = Inf;
+        forEachNextState(mask, node, prev, lastNonRingNode, [&](int nextNode, int, EdgeCostType cost, EdgeCostType nextTimeToFinish) {
+            bestTime = std::min(bestTime, cost + (nextNode == n - 1 ? 0 : nextTimeToFinish));
+        });
+        return bestTime;
+    };
+    auto isInMask = [](uint64_t mask, int node) {
+        return node == 0 || (mask & (uint64_t(1) << (node - 1)));
+    };
+    auto fillTimeToFinish = [&](uint64_t mask) {
+        auto maskIndex = tableIndex(mask);
+        for (int node = 1; node < n - 1; ++node) {
+            if (!isInMask(mask, node))
+                continue;
+            std::bitset<256> isPrevClassDone;
+            for (int prev = 0; prev < n - 1; ++prev) {
+                if (prev == node || !isInMask(mask, prev) || isPrevClassDone.test(states.prevClass[node * n + prev]))
+                    continue;
+                isPrevClassDone.set(states.prevClass[node * n + prev]);
+                int lastNonRingNodeBegin = states.isRingCp[node] ? 0 : node;
+                int lastNonRingNodeEnd = states.isRingCp[node] ? n - 1 : node + 1;
+                for (int lastNonRingNode = lastNonRingNodeBegin; lastNonRingNode < lastNonRingNodeEnd; ++lastNonRingNode) {
+                    if (states.isRingCp[lastNonRingNode] || !isInMask(mask, lastNonRingNode))
+                        continue;
+                    timeToFinish[maskIndex + states.index(node, prev, lastNonRingNode)] = calculateTimeToFinish(mask, node, prev, lastNonRingNode);
+                }
+            }
+        }
+    };
+
+    /*
+        Sets of one layer are split between threads in blocks of consecutive ranks. First set of a block
+        is unranked from the combinatorial number system, the rest are the next bigger masks with the same number of bits.
+    */
+    auto maskWithRank = [&](uint64_t rank, int layer) {
+        uint64_t mask = 0;
+        int cp = cpCount;
+        for (int i = layer; i >= 1; --i) {
+            do {
+                cp -= 1;
+            } while (binomial[cp][i] > rank);
+            mask |= uint64_t(1) << cp;
+            rank -= binomial[cp][i];
+        }
+        return mask;
+    };
+    auto nextMaskWithSameCount = [](uint64_t mask) {
+        uint64_t lowestBit = mask & (~mask + 1);
+        uint64_t ripple = mask + lowestBit;
+        return (((ripple ^ mask) >> 2) / lowestBit) | ripple;
+    };
+    ThreadPool threadPool(ThreadCount);
+    for (int layer = cpCount; layer >= std::max(junctionLayer, 1); --layer) {
+        auto layerSetCount = binomial[cpCount][layer];
+        for (int i = 0; i < ThreadCount; ++i) {
+            threadPool.addTask([&, layer, layerSetCount, i](int) {
+                for (uint64_t blockStart = i * MaskBlockSize; blockStart < layerSetCount; blockStart += ThreadCount * MaskBlockSize) {
+                    if (config.stopWorking())
+                        break;
+                    auto mask = maskWithRank(blockStart, layer);
+                    for (auto rank = blockStart; rank < blockStart + MaskBlockSize && rank < layerSetCount; ++rank) {
+                        fillTimeToFinish(mask);
+                        config.lazyIncrementPartialSolutionCount();
+                        mask = nextMaskWithSameCount(mask);
+                    }
+                }
+                config.flushPartialSolutionCount();
+            });
+        }
+        threadPool.wait();
+    }
+    if (config.stopWorking())
+        return;
+
+    struct RouteEdge {
+        int previousEdgeIndex;
+        NodeType src;
+        NodeType dst;
+    };
+    struct PartialRoute {
+        EdgeCostType time; // time so far + time to finish
+        EdgeCostType timeSoFar;
+        uint64_t mask;
+        NodeType node;
+        NodeType prev;
+        NodeType lastNonRingNode;
+        int lastEdgeIndex;
+
+        bool operator<(const PartialRoute& other) const {
+            return time > other.time;
+        }
+    };
+    std::vector<RouteEdge> routeEdges;
+    std::vector<PartialRoute> routeQueue; // binary heap, kept as vector so its capacity counts towards the memory cap
+    std::vector<CompressedEdge> edges;
+
+    /*
+        Below junction layer the time to finish is only a lower bound, so many partial routes with the same state can be
+        popped before any of them completes. Once K of them with distinct smaller times were expanded, every completion
+        of the next one is beaten by K routes with different times, so it's skipped (same argument as in node by node search).
+    */
+    std::unique_ptr<KBestCostTable> expandedStates;
+    if (junctionLayer > 0) {
+        uint64_t forwardStateCount = 0;
+        for (int layer = 0; layer < junctionLayer; ++layer) {
+            forwardStateCount += binomial[cpCount][layer] * states.count;
+        }
+        auto memory = std::min<uint64_t>(MaxTableMemory / 8, forwardStateCount * KBestCostTable::MemoryPerKey(config.maxSolutionCount));
+        expandedStates = std::make_unique<KBestCostTable>(config.maxSolutionCount, memory);
+    }
+    auto stateKey = [&](const PartialRoute& route) {
+        uint64_t x = (route.mask * states.count + states.index(route.node, route.prev, route.lastNonRingNode)) * 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        return x ^ (x >> 31);
+    };
+
+    auto startTime = junctionLayer == 0 ? calculateTimeToFinish(0, 0, 0, 0) : timeToFinishLowerBound(0, 0);
+    if (startTime < Inf)
+        routeQueue.push_back(PartialRoute{ startTime, 0, 0, 0, 0, 0, -1 });
+    while (!routeQueue.empty() && !config.stopWorking()) {
+        // same cap as the queue of node by node search - routes found so far are still the exact fastest ones
+        if (routeEdges.capacity() * sizeof(RouteEdge) + routeQueue.capacity() * sizeof(PartialRoute) > MaxTableMemory) {
+            state.endedAtMemoryLimit = true;
+            break;
+        }
+        std::pop_heap(routeQueue.begin(), routeQueue.end());
+        auto route = routeQueue.back();
+        routeQueue.pop_back();
+        if (route.time > config.limit() || (config.bestSolutions.size() >= config.maxSolutionCount && route.time >= config.limit()))
+            break;
+        if (expandedStates && route.node != n - 1 && int(std::bitset<32>(route.mask).count()) < junctionLayer && !expandedStates->insert(stateKey(route), route.timeSoFar))
+            continue;
+        if (route.node == n - 1) {
+            edges.clear();
+            for (int i = route.lastEdgeIndex; i != -1; i = routeEdges[i].previousEdgeIndex) {
+                edges.push_back(CompressedEdge{ 0, routeEdges[i].src, routeEdges[i].dst });
+            }
+            std::reverse(edges.begin(), edges.end());
+            saveSolution(config, edges);
+            continue;
+        }
+        forEachNextState(route.mask, route.node, route.prev, route.lastNonRingNode, [&](int nextNode, int srcNode, EdgeCostType cost, EdgeCostType nextTimeToFinish) {
+            auto timeSoFar = route.timeSoFar + cost;
+            auto time = timeSoFar + (nextNode == n - 1 ? 0 : nextTimeToFinish);
+            if (time > config.limit())
+                return;
+            auto nextMask = nextNode == n - 1 ? route.mask : route.mask | (uint64_t(1) << (nextNode - 1));
+            int nextLastNonRingNode = states.isRingCp[nextNode] ? route.lastNonRingNode : nextNode;
+            routeEdges.push_back(RouteEdge{ route.lastEdgeIndex, NodeType(srcNode), NodeType(nextNode) });
+            routeQueue.push_back(PartialRoute{ time, timeSoFar, nextMask, NodeType(nextNode), NodeType(srcNode), NodeType(nextLastNonRingNode), int(routeEdges.size()) - 1 });
+            std::push_heap(routeQueue.begin(), routeQueue.end());
+        });
+    }
+}
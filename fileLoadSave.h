@@ -2,6 +2,7 @@
 #include "utility.h"
 #include "common.h"
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <string>
 #include <charconv>
@@ -241,6 +242,18 @@ void overwriteFileWithSortedSolutions(const std::string& outputFileName, const s
     }
 }
 
+std::string solutionsLogFileName(const std::string& outputFileName) {
+    return outputFileName + ".log";
+}
+
+std::string solutionLogLine(const std::string& solutionString, int time, int variationCount) {
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1);
+    line << std::setw(8) << time / 10.0 << " ";
+    line << solutionString << " " << variationCount;
+    return line.str();
+}
+
 void clearFile(const std::string& outputFileName) {
     if (outputFileName.empty())
         return;
@@ -10,6 +10,7 @@
 #include "assignmentRelaxationSolutionFinder.h"
 #include "arborescenceRelaxationSolutionFinder.h"
 #include "bruteForceSolutionFinder.h"
+#include "dynamicProgrammingSolutionFinder.h"
 #include "Lin-KernighanSolutionFinder.h"
 #include "solutionFinderCommon.h"
 #include "utility.h"
@@ -246,6 +247,7 @@ int main(int argc, char** argv) {
     std::atomic<bool> stopWorkingForConfig;
     std::atomic<int> limitForConfig;
     SolutionConfig config(stopWorkingForConfig);
+    state.solutionsReaderId = config.solutionsVec.addReader();
     config.limit_ = &limitForConfig;
     config.maxSolutionCount = input.maxSolutionCount;
     config.partialSolutionCount = 0;
@@ -369,6 +371,17 @@ int main(int argc, char** argv) {
                     if (input.showAdvancedSettings) {
                         tableInputEntryInt("max connection time", input.ignoredValue, 1, 100'000, "Connections with this or higher time\nwill not be considered in the solutions.");
                         tableInputEntryInt("max route time", input.limitValue, 1, 100'000, "Maximum time route can take to be considered as a valid solution.\n\nFor \"Heuristic\" algorithm this is irrelevant, but for \"Exact\" algorithm lowering this value might help the algorithm complete the search faster.");
+                        tableInputEntryInt("heuristic candidates", input.heuristicCandidateCount, 0, 255, "Only for \"Heuristic\" algorithm.\n\nFor every CP the heuristic only tries adding connections that are among this many fastest connections going out of it or coming into the other CP.\nLower values make every improvement step much faster, but connections outside of these lists are only used if the starting route already had them.\nIf 0 all connections are tried.");
+                        tableInputEntry("heuristic kicks", "Only for \"Heuristic\" algorithm.\n\nIf this is ON, once a route can't be improved any further the heuristic perturbs it a little (a \"kick\") and keeps improving from there instead of starting over from a new random route.", [&]() {
+                            ImGui::Checkbox("##heuristic kicks", &input.heuristicIteratedKicks);
+                        });
+                        tableInputEntry("kick acceptance", "Only for \"Heuristic\" algorithm with \"heuristic kicks\" ON.\n\nWhich route the next kick starts from:\nBetter only - only from a route faster than the current one.\nThreshold - also from a route at most \"kick acceptance time\" slower.\nAnnealing - also from slower routes, with a chance that gets smaller the slower the route is.", [&]() {
+                            const char* kickAcceptanceNames[] = { "Better only", "Threshold", "Annealing" };
+                            int kickAcceptance = int(input.heuristicKickAcceptance);
+                            if (ImGui::Combo("##kick acceptance", &kickAcceptance, kickAcceptanceNames, IM_ARRAYSIZE(kickAcceptanceNames)))
+                                input.heuristicKickAcceptance = KickAcceptance(kickAcceptance);
+                        });
+                        tableInputEntryInt("kick acceptance time", input.heuristicKickAcceptanceTime, 0, 100'000, "Only for \"Heuristic\" algorithm with \"heuristic kicks\" ON.\n\nFor \"Threshold\" acceptance how many seconds slower a route can be to still be kicked from.\nFor \"Annealing\" the starting temperature in seconds.");
                     }
                     ImGui::EndTable();
                 }
@@ -384,6 +397,16 @@ int main(int argc, char** argv) {
                         ImGui::Checkbox("Allow repeat CPs for filled connections", &input.allowRepeatCpsForFilledConnections);
                         ImGui::SameLine();
                         HelpMarker(state, "If this is OFF then only connections with time equal to or higher than \"max connection time\" will be replaced with connections that go through other CPs.\nIf this is ON all connections are subject to be overwritten by repeat CP connections.");
+                        tableInputEntry("find routes in order", "Only for default algorithm.\n\nIf this is ON routes are found one by one, fastest first - every route is known to be the next fastest one as soon as it shows up, so you can start driving the first one while the rest is still being calculated.\nThis is usually slower overall than the normal search.", [&]() {
+                            ImGui::Checkbox("##find routes in order", &input.emitRoutesInProvenOrder);
+                        });
+                        tableInputEntry("prune repeated states", "Only for node-by-node algorithm.\n\nIf this is ON partial routes that end in the same state (same visited CPs and same last CPs) as K faster ones already seen are skipped, where K is \"max nr of routes\".\nThis can make the search a lot faster on maps where many orderings lead to the same state, but it takes up to 1GB of extra memory and on other maps it can make the search slower.", [&]() {
+                            ImGui::Checkbox("##prune repeated states", &input.pruneRepeatedPartialRoutes);
+                        });
+                        ImGui::TableNextColumn();
+                        ImGui::Checkbox("Write routes log while running", &input.streamRoutesToLog);
+                        ImGui::SameLine();
+                        HelpMarker(state, "If this is ON every route is appended to \"<output data file>.log\" as soon as it's found (time, route, number of variations), so the results aren't lost if the program gets closed and the file can be followed from other tools.\nRoutes are written in the order they were found and the same route can show up again with a higher number of variations.\nThe \"output data file\" is still written with the sorted list at the end.");
                     }
                     ImGui::EndTable();
                 }
@@ -527,6 +550,10 @@ int main(int argc, char** argv) {
                         if (ImGui::Button("Run arborescence algorithm", ImVec2(-1, 0))) {
                             startAlgorithm(Algorithm::Arborescence);
                         }
+                        ImGui::TableNextColumn();
+                        if (ImGui::Button("Run dynamic programming algorithm", ImVec2(-1, 0))) {
+                            startAlgorithm(Algorithm::DynamicProgramming);
+                        }
                     } else if (input.ringCps[0] != '\0') {
                         if (ImGui::Button("Run node-by-node algorithm", ImVec2(-1, 0))) {
                             startAlgorithm(Algorithm::BruteForce);
@@ -556,11 +583,12 @@ int main(int argc, char** argv) {
                 auto getRequiredAndOptionalConnectionSets = [&]() -> std::pair<FastSet2d, FastSet2d> {
                     if (state.bestFoundSolutions.empty())
                         return {};
-                    auto allConnectionsSet = state.bestFoundSolutions[0].solutionConnections;
-                    auto commonConnectionsSet = state.bestFoundSolutions[0].solutionConnections;
+                    auto allConnectionsSet = state.bestFoundSolutions[0].connectionsSet(config.nodeCount());
+                    auto commonConnectionsSet = allConnectionsSet;
                     for (auto& solution : state.bestFoundSolutions) {
-                        allConnectionsSet |= solution.solutionConnections;
-                        commonConnectionsSet &= solution.solutionConnections;
+                        auto connectionsSet = solution.connectionsSet(config.nodeCount());
+                        allConnectionsSet |= connectionsSet;
+                        commonConnectionsSet &= connectionsSet;
                     }
                     auto diffConnectionsSet = allConnectionsSet;
                     diffConnectionsSet -= commonConnectionsSet;
@@ -620,7 +648,7 @@ int main(int argc, char** argv) {
                                 }
                             }
                             for (auto& s : config.bestSolutions) {
-                                auto set = s.solutionConnections;
+                                auto set = s.connectionsSet(config.nodeCount());
                                 set &= bannedConnections;
                                 if (!set.any()) {
                                     state.bestFoundSolutions.push_back(s);
@@ -672,6 +700,11 @@ int main(int argc, char** argv) {
                             status = "Timeout (Still running)";
                         else
                             status = "Timeout";
+                    } else if (state.endedAtMemoryLimit) {
+                        if (isRunning(state.algorithmRunTask))
+                            status = "Memory limit (Still running)";
+                        else
+                            status = "Stopped at memory limit after " + std::to_string(config.bestSolutions.size()) + " routes";
                     } else if (state.taskWasCanceled) {
                         if (isRunning(state.algorithmRunTask))
                             status = "Canceled (Still running)";
@@ -703,10 +736,12 @@ int main(int argc, char** argv) {
                             ImGui::Text("Completed ");
                             ImGui::SameLine();
                             addNumberPadding(int(tryVal), 1000);
-                            ImGui::Text("%d tries for %d-opt", tryVal, optVal);
+                            ImGui::Text("%d tries (up to %d-opt)", tryVal, optVal);
                         }
                     } else if (state.currentAlgorithm == Algorithm::Assignment || state.currentAlgorithm == Algorithm::Arborescence || state.currentAlgorithm == Algorithm::BruteForce) {
                         ImGui::Text("Partial routes processed: %s", config.partialSolutionCountString().c_str());
+                    } else if (state.currentAlgorithm == Algorithm::DynamicProgramming) {
+                        ImGui::Text("Sets of visited CPs processed: %s", config.partialSolutionCountString().c_str());
                     } else {
                         ImGui::Text("");
                     }
@@ -725,11 +760,25 @@ int main(int argc, char** argv) {
                     for (auto& connection : optionalConnectionsSet.toSortedList()) {
                         state.resultOptionalConnections.emplace_back(connection, FilterConnection::Optional);
                     }
-                } else if (!state.copiedBestSolutionsAfterAlgorithmDone && config.solutionsVec.size() > state.bestFoundSolutions.size()) {
-                    for (int i = int(state.bestFoundSolutions.size()); i < config.solutionsVec.size(); ++i) {
-                        state.bestFoundSolutions.push_back(config.solutionsVec[i]);
+                } else if (!state.copiedBestSolutionsAfterAlgorithmDone) {
+                    auto oldSize = state.bestFoundSolutions.size();
+                    config.solutionsVec.readNew(state.solutionsReaderId, [&](const BestSolution& solution) {
+                        state.bestFoundSolutions.push_back(solution);
+                    });
+                    if (state.bestFoundSolutions.size() > oldSize) {
+                        // only the fastest "max nr of routes" are shown, so there is no point keeping the rest
+                        // (selected by time, since the display order can be by connection instead)
+                        if (state.bestFoundSolutions.size() > config.maxSolutionCount) {
+                            auto newEnd = state.bestFoundSolutions.begin() + config.maxSolutionCount;
+                            std::nth_element(state.bestFoundSolutions.begin(), newEnd, state.bestFoundSolutions.end(), [](auto& a, auto& b) {
+                                if (a.time != b.time)
+                                    return a.time < b.time;
+                                return a.solution() < b.solution();
+                            });
+                            state.bestFoundSolutions.erase(newEnd, state.bestFoundSolutions.end());
+                        }
+                        sortBestFoundSolutionsSolutions(state, input);
                     }
-                    sortBestFoundSolutionsSolutions(state, input);
                 }
                 auto bestSolutionCount = std::min<int>(int(state.bestFoundSolutions.size()), config.maxSolutionCount);
                 auto maxSolutionTime = state.bestFoundSolutions.empty() ? 0 : std::max_element(state.bestFoundSolutions.begin(), state.bestFoundSolutions.begin() + bestSolutionCount, [](auto& a, auto& b) { return a.time < b.time; })->time;
@@ -166,6 +166,8 @@ struct MinSpanningArborescence {
             lastProcessedId[node] = i;
 
             const auto [minWeight, minEdge] = getMinInEdge(node);
+            if (minWeight >= Inf)
+                return Inf; // no edge into this node left
             addedEdges.push_back(minEdge);
             forest[i] = i;
             result += minWeight;
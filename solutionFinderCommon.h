@@ -21,8 +21,8 @@
 #include <filesystem>
 #include <numeric>
 
-std::vector<SolutionEdge> createSolution(const SolutionConfig& config, const std::vector<CompressedEdge>& edges) {
-    std::vector<SolutionEdge> result;
+void createSolution(const SolutionConfig& config, const std::vector<CompressedEdge>& edges, std::vector<SolutionEdge>& result) {
+    result.clear();
     auto prev = getUnconditionalPrev(config);
     for (int i = 0; i < edges.size(); ++i) {
         bool isRespawn = (i > 0 && edges[i].src != edges[i - 1].dst) || config.useRespawnMatrix[edges[i].dst][edges[i].src][prev];
@@ -35,6 +35,10 @@ std::vector<SolutionEdge> createSolution(const SolutionConfig& config, const std
         result.push_back(solutionEdge);
         prev = solutionEdge.src;
     }
+}
+std::vector<SolutionEdge> createSolution(const SolutionConfig& config, const std::vector<CompressedEdge>& edges) {
+    std::vector<SolutionEdge> result;
+    createSolution(config, edges, result);
     return result;
 }
 
@@ -85,8 +89,8 @@ FastSmallVector<CompressedEdge, 6> getCompressedEdges(const SolutionConfig& conf
     }
     return result;
 }
-std::vector<CompressedEdge> getCompressedSolution(const SolutionConfig& config, const std::vector<SolutionEdge>& solution, CompressedEdgeType edgeType) {
-    std::vector<CompressedEdge> result;
+void getCompressedSolution(const SolutionConfig& config, const std::vector<SolutionEdge>& solution, CompressedEdgeType edgeType, std::vector<CompressedEdge>& result) {
+    result.clear();
     for (auto& edge : solution) {
         auto compressedEdges = getCompressedEdges(config, edge, edgeType);
         result.insert(result.end(), compressedEdges.data.data(), compressedEdges.data.data() + compressedEdges.size());
@@ -100,6 +104,10 @@ std::vector<CompressedEdge> getCompressedSolution(const SolutionConfig& config,
             return a.dst < b.dst;
         });
     }
+}
+std::vector<CompressedEdge> getCompressedSolution(const SolutionConfig& config, const std::vector<SolutionEdge>& solution, CompressedEdgeType edgeType) {
+    std::vector<CompressedEdge> result;
+    getCompressedSolution(config, solution, edgeType, result);
     return result;
 }
 
@@ -167,12 +175,6 @@ std::string createSolutionString(const SolutionConfig& config, const std::vector
     solStr += "]";
     return solStr;
 }
-FastSet2d solutionConnectionsSet(const std::vector<CompressedEdge>& compressedEdgesWithRepeats, int nodeCount) {
-    FastSet2d result(nodeCount);
-    for (auto edge : compressedEdgesWithRepeats)
-        result.set(edge.dst, edge.src);
-    return result;
-}
 std::vector<std::array<int16_t, 3>> solutionUnverifiedConnectionsList(const SolutionConfig& config, const std::vector<SolutionEdge>& solution) {
     std::vector<std::array<int16_t, 3>> result;
     for (auto& edge : solution) {
@@ -183,41 +185,57 @@ std::vector<std::array<int16_t, 3>> solutionUnverifiedConnectionsList(const Solu
     return result;
 }
 
-void insertSortedByTimeAndConnectionOrder(std::vector<BestSolution>& vec, const BestSolution& val) {
-    vec.insert(std::upper_bound(vec.begin(), vec.end(), val, [](auto& a, auto& b) {
+void insertSortedByTimeAndConnectionOrder(std::vector<BestSolution>& vec, BestSolution val) {
+    auto pos = std::upper_bound(vec.begin(), vec.end(), val, [](auto& a, auto& b) {
         if (a.time != b.time)
             return a.time < b.time;
         return a.solution() < b.solution();
-    }), val);
+    });
+    vec.insert(pos, std::move(val));
 }
 void saveSolutionAndUpdateLimit(SolutionConfig& config, const std::vector<CompressedEdge>& edges) {
-    auto solution = createSolution(config, edges);
+    /*
+        Most routes that get here are rejected, either by the limit or because they were
+        already found, so everything up to that point is built in thread local buffers.
+        Heap owned copies are only made for routes that end up in bestSolutions.
+    */
+    thread_local std::vector<SolutionEdge> solution;
+    thread_local std::vector<CompressedEdge> compressedSolution;
+    thread_local std::vector<CompressedEdge> compressedVariation;
+
+    createSolution(config, edges, solution);
     auto time = calculateSolutionTime(config, solution);
-    std::scoped_lock l{ config.solutionUpdateMutex };
-    if (time > config.limit() || (config.bestSolutions.size() >= config.maxSolutionCount && time >= config.limit()))
+    // limit never goes up during a search, so this can be checked before doing any other work
+    if (time > config.limit())
         return;
 
-    auto edgeTypeStrictVariation = CompressedEdgeType(NonRepeat | SequenceDependent | Sorted);
     auto edgeTypePermissiveVariation = CompressedEdgeType(Repeat | SequenceDependentIsh | Sorted);
     auto edgeTypeUnique = CompressedEdgeType(NonRepeat | NonSequenceDependent | NonSorted);
 
-    auto compressedSolution = getCompressedSolution(config, solution, edgeTypeUnique);
-    auto compressedSolutionForStrictVariations = getCompressedSolution(config, solution, edgeTypeStrictVariation);
-    auto compressedSolutionForPermissiveVariations = getCompressedSolution(config, solution, edgeTypePermissiveVariation);
-
-    auto& compressedVariation = compressedSolutionForPermissiveVariations; // TODO: Make this dependent on some new flag in .config
-    auto solutionConnections = solutionConnectionsSet(compressedSolutionForPermissiveVariations, config.nodeCount());
-    for (int i = 0; i < config.bestSolutions.size(); ++i) {
-        if (config.bestSolutions[i].time == time) {
-            if (compressedVariation == config.bestSolutions[i].compressedVariation) {
-                for (auto& variation : config.bestSolutions[i].variations) {
-                    if (compressedSolution == variation.compressedSolution) {
-                        return;
-                    }
+    getCompressedSolution(config, solution, edgeTypeUnique, compressedSolution);
+    getCompressedSolution(config, solution, edgeTypePermissiveVariation, compressedVariation); // TODO: Make variation type dependent on some new flag in .config
+    auto fingerprint = solutionFingerprint(time, compressedVariation, compressedSolution);
+    if (config.solutionFingerprints.contains(fingerprint))
+        return;
+
+    std::scoped_lock l{ config.solutionUpdateMutex };
+    if (time > config.limit() || (config.bestSolutions.size() >= config.maxSolutionCount && time >= config.limit()))
+        return;
+
+    auto sameTimeBegin = std::lower_bound(config.bestSolutions.begin(), config.bestSolutions.end(), time, [](auto& a, int time) { return a.time < time; });
+    for (auto it = sameTimeBegin; it != config.bestSolutions.end() && it->time == time; ++it) {
+        if (compressedVariation == it->compressedVariation) {
+            for (auto& variation : it->variations) {
+                if (compressedSolution == variation.compressedSolution) {
+                    return;
                 }
-                config.bestSolutions[i].variations.push_back({ solution, compressedSolution });
-                return;
             }
+            it->variations.push_back({ solution, compressedSolution });
+            config.solutionFingerprints.insert(fingerprint);
+            if (config.solutionsLog) {
+                config.solutionsLog->write(solutionLogLine(it->solutionString, time, it->variations.size()));
+            }
+            return;
         }
     }
     auto sortedSolution = getSortedSolutionIfPossible(config, solution, edgeTypePermissiveVariation);
@@ -225,11 +243,19 @@ void saveSolutionAndUpdateLimit(SolutionConfig& config, const std::vector<Compre
     auto solutionString = createSolutionString(config, sortedSolution.empty() ? solution : sortedSolution);
     auto unverifiedConnections = solutionUnverifiedConnectionsList(config, solution);
 
-    auto newSolution = BestSolution({ solution, compressedSolution }, { sortedSolution, compressedSortedSolution }, compressedVariation, solutionConnections, unverifiedConnections, solutionString, config.addedConnection, time);
-    config.solutionsVec.push_back_not_thread_safe(newSolution);
-    insertSortedByTimeAndConnectionOrder(config.bestSolutions, newSolution);
+    if (config.solutionsLog) {
+        config.solutionsLog->write(solutionLogLine(solutionString, time, 1));
+    }
+    auto newSolution = BestSolution({ solution, compressedSolution }, { std::move(sortedSolution), std::move(compressedSortedSolution) }, compressedVariation, std::move(unverifiedConnections), std::move(solutionString), config.addedConnection, time);
+    config.solutionsVec.push_back(newSolution);
+    insertSortedByTimeAndConnectionOrder(config.bestSolutions, std::move(newSolution));
+    config.solutionFingerprints.insert(fingerprint);
     if (config.bestSolutions.size() > config.maxSolutionCount) {
-        config.updateLimit(config.bestSolutions.back().time);
+        auto& evicted = config.bestSolutions.back();
+        config.updateLimit(evicted.time);
+        for (auto& variation : evicted.variations) {
+            config.solutionFingerprints.erase(solutionFingerprint(evicted.time, evicted.compressedVariation, variation.compressedSolution));
+        }
         config.bestSolutions.pop_back();
     }
 }
@@ -238,13 +264,116 @@ void saveSolution(SolutionConfig& config, const std::vector<CompressedEdge>& edg
     saveSolutionAndUpdateLimit(config, edges);
 }
 void saveSolution(SolutionConfig& config, const std::vector<NodeType>& solution) {
-    std::vector<CompressedEdge> edges = { {0, 0, solution[0]} };
+    thread_local std::vector<CompressedEdge> edges;
+    edges = { {0, 0, solution[0]} };
     for (int i = 1; i < solution.size() - 1; ++i) {
         edges.push_back({ 0, edges.back().dst, solution[edges.back().dst]});
     }
     saveSolution(config, edges);
 }
 
+/*
+    Saves all routes that follow given main path, where at mainPath[i] the route first goes
+    through every chain from subTrees[i] (each chain ends with a respawn back to mainPath[i]).
+    Only the chain taken first after arriving at a node can change the time - the other ones
+    and the main path edge start with a respawn - so the choice at every node adds its own
+    time difference independently of the others.
+    This lets us generate the routes cheapest first and stop as soon as we go over the limit,
+    instead of building every combination.
+*/
+void saveSolutionsWithSubTreeOrders(SolutionConfig& config, const std::vector<NodeType>& mainPath, const std::vector<std::vector<std::vector<CompressedEdge>>>& subTrees) {
+    thread_local std::vector<CompressedEdge> route;
+    thread_local std::vector<SolutionEdge> solution;
+    std::vector<int> firstSubTree(mainPath.size(), 0);
+    auto buildRoute = [&]() {
+        route.clear();
+        for (int i = 0; i + 1 < mainPath.size(); ++i) {
+            auto& nodeSubTrees = subTrees[i];
+            if (!nodeSubTrees.empty()) {
+                auto& first = nodeSubTrees[firstSubTree[i]];
+                route.insert(route.end(), first.begin(), first.end());
+                for (int j = 0; j < nodeSubTrees.size(); ++j) {
+                    if (j != firstSubTree[i]) {
+                        route.insert(route.end(), nodeSubTrees[j].begin(), nodeSubTrees[j].end());
+                    }
+                }
+            }
+            route.push_back(CompressedEdge{ 0, mainPath[i], mainPath[i + 1] });
+        }
+    };
+    auto routeTime = [&]() {
+        createSolution(config, route, solution);
+        return calculateSolutionTime(config, solution);
+    };
+
+    std::vector<int> branchingNodes;
+    for (int i = 0; i < subTrees.size(); ++i) {
+        if (subTrees[i].size() >= 2) {
+            branchingNodes.push_back(i);
+        }
+    }
+    buildRoute();
+    if (branchingNodes.empty()) {
+        saveSolution(config, route);
+        return;
+    }
+
+    // for every branching node list of (time difference, first chain) sorted from the cheapest
+    auto baseTime = routeTime();
+    std::vector<std::vector<std::pair<int, int>>> choices(branchingNodes.size());
+    for (int k = 0; k < branchingNodes.size(); ++k) {
+        auto node = branchingNodes[k];
+        for (int i = 0; i < subTrees[node].size(); ++i) {
+            firstSubTree[node] = i;
+            buildRoute();
+            choices[k].emplace_back(routeTime() - baseTime, i);
+        }
+        firstSubTree[node] = 0;
+        std::sort(choices[k].begin(), choices[k].end());
+    }
+    for (auto& nodeChoices : choices) {
+        baseTime += nodeChoices[0].first;
+    }
+
+    /*
+        Standard best first enumeration of combinations of sorted lists - every combination
+        is reached exactly once by only advancing positions at or after the last advanced one.
+    */
+    struct Combination {
+        int time;
+        int lastAdvanced;
+        std::vector<int> choiceIds;
+        bool operator<(const Combination& other) const {
+            return time > other.time;
+        }
+    };
+    std::priority_queue<Combination> queue;
+    queue.push(Combination{ baseTime, 0, std::vector<int>(branchingNodes.size(), 0) });
+    while (!queue.empty()) {
+        auto combination = queue.top();
+        queue.pop();
+        if (combination.time > config.limit())
+            break;
+
+        for (int k = 0; k < branchingNodes.size(); ++k) {
+            firstSubTree[branchingNodes[k]] = choices[k][combination.choiceIds[k]].second;
+        }
+        buildRoute();
+        saveSolution(config, route);
+
+        for (int k = combination.lastAdvanced; k < branchingNodes.size(); ++k) {
+            auto id = combination.choiceIds[k];
+            if (id + 1 < choices[k].size()) {
+                auto next = combination;
+                next.time += choices[k][id + 1].first - choices[k][id].first;
+                next.lastAdvanced = k;
+                next.choiceIds[k] += 1;
+                queue.push(std::move(next));
+            }
+        }
+    }
+}
+
 struct RepeatEdgePath {
     RepeatEdgePath(int k, int j, int i) : k(k), j(j), i(i) {}
     int k, j, i;
@@ -459,14 +588,9 @@ std::pair<std::vector<CompressedEdge>, double> createSolutionFromString(std::str
     return { solution, realCost / 10.0 };
 }
 
-void overwriteFileWithSortedSolutions(const std::string& outputFileName, int maxSolutionCount, const ThreadSafeVec<BestSolution>& solutionsView, SolutionConfig& config) {
+void overwriteFileWithSortedSolutions(const std::string& outputFileName, int maxSolutionCount, const std::vector<BestSolution>& sortedSolutions, SolutionConfig& config) {
     if (outputFileName.empty())
         return;
-    std::vector<BestSolution> sortedSolutions;
-    for (int i = 0; i < solutionsView.size(); ++i) {
-        sortedSolutions.push_back(solutionsView[i]);
-    }
-    std::sort(sortedSolutions.begin(), sortedSolutions.end(), [](auto& a, auto& b) { return a.time < b.time; });
     std::vector<std::pair<std::string, int>> solutions;
     for (int i = 0; i < maxSolutionCount && i < sortedSolutions.size(); ++i) {
         solutions.push_back({ createSolutionString(config, sortedSolutions[i].solution()), sortedSolutions[i].time});
@@ -505,7 +629,10 @@ struct State {
 
     Algorithm currentAlgorithm = Algorithm::None;
     bool endedWithTimeout = false;
+    bool endedAtMemoryLimit = false;
     std::thread timerThread;
+    std::unique_ptr<BackgroundFileWriter> solutionsLog;
+    int solutionsReaderId = -1;
 
     bool isGraphWindowOpen = false;
     BestSolution solutionToShowInGraphWindow;
@@ -547,17 +674,32 @@ struct State {
 struct LinKernighanSettings {
     int maxSequenceLengthLimit = 1'000;
     int tryCount = 1'000;
+    int candidateListSize = 0;
     bool fullRingCpMode = false;
+    bool iteratedKicks = true;
+    KickAcceptance kickAcceptance = KickAcceptance::Threshold;
+    int kickAcceptanceTime = 10; // how much slower (Threshold) or temperature (Annealing) for a kicked route to become the new base
     std::vector<BestSolution> initialSolutions = {};
 };
 
 void findSolutionsAssignment(SolutionConfig& config);
+void findSolutionsAssignmentInProvenOrder(SolutionConfig& config);
 void findSolutionsArborescence(SolutionConfig& config);
 void findSolutionsLinKernighan(SolutionConfig& config, LinKernighanSettings settings);
-void findSolutionsBruteForce(SolutionConfig& config);
+void findSolutionsBruteForce(SolutionConfig& config, bool pruneRepeatedPartialRoutes);
+void findSolutionsDynamicProgramming(SolutionConfig& config, State& state);
+constexpr int DynamicProgrammingMaxCpCount = 30;
 
-void findSolutionsLinKernighan(SolutionConfig& config, State& state, bool isFastMode) {
+LinKernighanSettings linKernighanSettingsFromInput(const InputData& input) {
     LinKernighanSettings settings;
+    settings.candidateListSize = input.heuristicCandidateCount;
+    settings.iteratedKicks = input.heuristicIteratedKicks;
+    settings.kickAcceptance = input.heuristicKickAcceptance;
+    settings.kickAcceptanceTime = input.heuristicKickAcceptanceTime * 10;
+    return settings;
+}
+
+void findSolutionsLinKernighan(SolutionConfig& config, State& state, bool isFastMode, LinKernighanSettings settings) {
     if (!config.ringCps.empty()) {
         auto lkhConfig = config;
         lkhConfig.maxSolutionCount = 500;
@@ -572,14 +714,14 @@ void findSolutionsLinKernighan(SolutionConfig& config, State& state, bool isFast
         }
         config.partialSolutionCount = std::numeric_limits<uint64_t>::max();
         int maxTime = 1 + (config.nodeCount() >= 40) + (config.nodeCount() >= 75) + (config.nodeCount() >= 100);
-        auto timerThread = std::thread([&state, maxTime = maxTime, &lkhConfig, &config]() {
-            int copiedSolutionCount = 0;
+        auto solutionsReaderId = lkhConfig.solutionsVec.addReader();
+        auto timerThread = std::thread([&state, maxTime = maxTime, &lkhConfig, &config, solutionsReaderId]() {
             auto timer = Timer();
             while (!lkhConfig.stopWorking() && !config.stopWorking() && !state.taskWasCanceled && (maxTime == 0 || timer.getTime() < maxTime)) {
                 std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                for (; copiedSolutionCount < lkhConfig.solutionsVec.size(); ++copiedSolutionCount) {
-                    saveSolution(config, lkhConfig.solutionsVec[copiedSolutionCount].compressedSolution());
-                }
+                lkhConfig.solutionsVec.readNew(solutionsReaderId, [&](const BestSolution& solution) {
+                    saveSolution(config, solution.compressedSolution());
+                });
             }
             lkhConfig.localStopWorking = true;
         });
@@ -597,6 +739,7 @@ void findSolutionsLinKernighan(SolutionConfig& config, State& state, bool isFast
 void runAlgorithm(Algorithm algorithm, SolutionConfig& config, InputData& input, State& state) {
     state.taskWasCanceled = false;
     state.endedWithTimeout = false;
+    state.endedAtMemoryLimit = false;
 
     std::string inputDataFile = input.inputDataFile;
     if (input.inputDataLink[0] != '\0') {
@@ -624,6 +767,7 @@ void runAlgorithm(Algorithm algorithm, SolutionConfig& config, InputData& input,
     config.ignoredValue = input.ignoredValue * 10;
     config.maxSolutionCount = input.maxSolutionCount;
     config.outputFileName = input.outputDataFile;
+    config.solutionsLog = nullptr;
     config.partialSolutionCount = 0;
     config.globalStopWorking = false;
     config.repeatNodeMatrix.clear();
@@ -652,6 +796,10 @@ void runAlgorithm(Algorithm algorithm, SolutionConfig& config, InputData& input,
     auto searchSourceNodes = parseIntList(input.connectionFinderSettings.searchSourceNodes, 0, config.weights.size() - 2, "search source CPs list", state.errorMsg);
     if (!state.errorMsg.empty())
         return;
+    if (algorithm == Algorithm::DynamicProgramming && config.nodeCount() - 2 > DynamicProgrammingMaxCpCount) {
+        state.errorMsg = "Dynamic programming algorithm supports maps with up to " + std::to_string(DynamicProgrammingMaxCpCount) + " CPs";
+        return;
+    }
 
     state.timer = Timer();
     state.timerThread = std::thread([&state, maxTime=0, &config]() {
@@ -667,7 +815,7 @@ void runAlgorithm(Algorithm algorithm, SolutionConfig& config, InputData& input,
         connectionFinderSettings.maxConnectionTime *= 10;
         connectionFinderSettings.testedConnectionTime *= 10;
         config.useExtendedMatrix = isUsingExtendedMatrix(config.condWeights);
-        config.bestSolutions.clear();
+        config.clearBestSolutions();
         state.connectionsToTest.clear();
         state.algorithmRunTask = std::async(std::launch::async | std::launch::deferred, [algorithm, &input, &state, &config, ringCps, repeatNodesTurnedOff, allowRepeatCpsForFilledConnections, searchSourceNodes, connectionFinderSettings]() mutable {
             auto privateConfig = config;
@@ -706,7 +854,7 @@ void runAlgorithm(Algorithm algorithm, SolutionConfig& config, InputData& input,
 
                 privateConfig.addedConnection = Edge{ src, dst };
                 privateConfig.weights[dst][src] = connectionFinderSettings.testedConnectionTime;
-                privateConfig.bestSolutions.clear();
+                privateConfig.clearBestSolutions();
                 privateConfig.solutionsVec.clear();
                 std::atomic<int> limit = config.limit();
                 privateConfig.limit_ = &limit;
@@ -720,12 +868,12 @@ void runAlgorithm(Algorithm algorithm, SolutionConfig& config, InputData& input,
                 if (algorithm == Algorithm::Assignment) {
                     findSolutionsAssignment(privateConfig);
                 } else {
-                    findSolutionsLinKernighan(privateConfig, state, true);
+                    findSolutionsLinKernighan(privateConfig, state, true, linKernighanSettingsFromInput(input));
                 }
 
                 if (!privateConfig.bestSolutions.empty()) {
                     auto& newSolution = privateConfig.bestSolutions[0];
-                    config.solutionsVec.push_back_not_thread_safe(newSolution);
+                    config.solutionsVec.push_back(newSolution);
                     insertSortedByTimeAndConnectionOrder(config.bestSolutions, newSolution);
                     if (config.bestSolutions.size() >= config.maxSolutionCount) {
                         config.updateLimit(config.bestSolutions.back().time);
@@ -748,23 +896,39 @@ void runAlgorithm(Algorithm algorithm, SolutionConfig& config, InputData& input,
             addRingCps(config, ringCps);
         }
         clearFile(config.outputFileName);
-        state.algorithmRunTask = std::async(std::launch::async | std::launch::deferred, [algorithm, &state, &config]() mutable {
+        state.solutionsLog.reset();
+        if (input.streamRoutesToLog && !config.outputFileName.empty()) {
+            state.solutionsLog = std::make_unique<BackgroundFileWriter>(solutionsLogFileName(config.outputFileName));
+            config.solutionsLog = state.solutionsLog.get();
+        }
+        bool emitRoutesInProvenOrder = input.emitRoutesInProvenOrder;
+        bool pruneRepeatedPartialRoutes = input.pruneRepeatedPartialRoutes;
+        auto heuristicSettings = linKernighanSettingsFromInput(input);
+        state.algorithmRunTask = std::async(std::launch::async | std::launch::deferred, [algorithm, emitRoutesInProvenOrder, pruneRepeatedPartialRoutes, heuristicSettings, &state, &config]() mutable {
             config.weights = createAtspMatrixFromInput(config.weights);
             std::fill(config.condWeights[0].back().begin(), config.condWeights[0].back().end(), 0);
             config.useExtendedMatrix = isUsingExtendedMatrix(config.condWeights);
-            config.bestSolutions.clear();
-            if (algorithm == Algorithm::Assignment) {
+            config.clearBestSolutions();
+            if (algorithm == Algorithm::Assignment && emitRoutesInProvenOrder) {
+                findSolutionsAssignmentInProvenOrder(config);
+            } else if (algorithm == Algorithm::Assignment) {
                 findSolutionsAssignment(config);
             } else if (algorithm == Algorithm::Arborescence) {
                 findSolutionsArborescence(config);
             } else if (algorithm == Algorithm::BruteForce) {
-                findSolutionsBruteForce(config);
+                findSolutionsBruteForce(config, pruneRepeatedPartialRoutes);
+            } else if (algorithm == Algorithm::DynamicProgramming) {
+                findSolutionsDynamicProgramming(config, state);
             } else {
-                findSolutionsLinKernighan(config, state, false);
+                findSolutionsLinKernighan(config, state, false, heuristicSettings);
             }
             config.globalStopWorking = true;
             state.timerThread.join();
-            overwriteFileWithSortedSolutions(config.outputFileName, config.maxSolutionCount, config.solutionsVec, config);
+            if (config.solutionsLog) {
+                config.solutionsLog->close();
+                config.solutionsLog = nullptr;
+            }
+            overwriteFileWithSortedSolutions(config.outputFileName, config.maxSolutionCount, config.bestSolutions, config);
             state.timer.stop();
         });
     }
@@ -13,9 +13,12 @@
 #include <iomanip>
 #include <array>
 #include <queue>
+#include <deque>
 #include <charconv>
 #include <condition_variable>
 #include <bitset>
+#include <climits>
+#include <immintrin.h>
 
 using Bool = int8_t;
 using EdgeCostType = int32_t;
@@ -148,6 +151,77 @@ public:
     }
 };
 
+/*
+    Appends lines to a file from a separate thread, so that callers only pay for
+    pushing a string into a buffer. Pending lines are written in batches and flushed
+    after every batch so that the file can be followed while it's being written.
+*/
+class BackgroundFileWriter {
+    std::ofstream file;
+    std::vector<std::string> pendingLines;
+    std::mutex pendingLinesMutex;
+    std::condition_variable pendingLinesCondVar;
+    std::thread writerThread;
+    bool active = false;
+
+    void writerLoop() {
+        std::vector<std::string> lines;
+        std::unique_lock lock(pendingLinesMutex);
+        while (true) {
+            pendingLinesCondVar.wait(lock, [this] {
+                return !pendingLines.empty() || !active;
+            });
+            std::swap(lines, pendingLines);
+            bool isLastBatch = !active;
+            lock.unlock();
+            for (auto& line : lines) {
+                file << line << '\n';
+            }
+            file.flush();
+            lines.clear();
+            lock.lock();
+            if (isLastBatch && pendingLines.empty())
+                break;
+        }
+    }
+
+public:
+    BackgroundFileWriter(const std::string& fileName) : file(fileName, std::ios::trunc) {
+        active = true;
+        writerThread = std::thread(&BackgroundFileWriter::writerLoop, this);
+    }
+
+    BackgroundFileWriter(const BackgroundFileWriter&) = delete;
+    BackgroundFileWriter(BackgroundFileWriter&&) = delete;
+    BackgroundFileWriter& operator=(const BackgroundFileWriter&) = delete;
+    BackgroundFileWriter& operator=(BackgroundFileWriter&&) = delete;
+
+    ~BackgroundFileWriter() {
+        close();
+    }
+
+    void write(std::string line) {
+        {
+            std::scoped_lock lock(pendingLinesMutex);
+            pendingLines.push_back(std::move(line));
+        }
+        pendingLinesCondVar.notify_one();
+    }
+
+    // writes all pending lines and stops the writer thread
+    void close() {
+        {
+            std::scoped_lock lock(pendingLinesMutex);
+            if (!active)
+                return;
+            active = false;
+        }
+        pendingLinesCondVar.notify_one();
+        writerThread.join();
+        file.close();
+    }
+};
+
 struct XorShift64 {
     using result_type = uint64_t;
     static constexpr result_type min() { return 0; }
@@ -157,6 +231,12 @@ struct XorShift64 {
         state = 0x12345678;
         xorShift64();
     }
+    XorShift64(uint64_t seed) {
+        state = 0x12345678 ^ (seed * 0x9e3779b97f4a7c15ull);
+        if (state == 0)
+            state = 0x12345678;
+        xorShift64();
+    }
     result_type operator()() {
         xorShift64();
         return state - 1;
@@ -293,58 +373,115 @@ uint64_t mostSignificantBitPosition(uint64_t a) {
 #endif
 }
 
-template<typename T> struct ThreadSafeVec {
-    static constexpr int smallestPower2 = 13;
-    std::vector<std::unique_ptr<std::vector<T>>> blocks;
-    int totalCapacity;
-    int size_;
+/*
+    Running minimum of values[i] for which masks[i] is 0, with masks[i] being either 0 or -1. Values are added
+    in rows with count being a multiple of 8 and kept in vector lanes until get(), which returns INT_MAX if
+    all values were masked. Uses AVX2 or SSE4.1 when the build targets them and plain SSE2 otherwise.
+*/
+class MaskedMinimum {
+#if defined(__AVX2__)
+    __m256i min = _mm256_set1_epi32(INT_MAX);
+#else
+    __m128i min = _mm_set1_epi32(INT_MAX);
+#endif
+public:
+    void add(const int32_t* values, const int32_t* masks, int count) {
+#if defined(__AVX2__)
+        auto maxValue = _mm256_set1_epi32(INT_MAX);
+        for (int i = 0; i < count; i += 8) {
+            auto mask = _mm256_loadu_si256((const __m256i*)&masks[i]);
+            auto value = _mm256_loadu_si256((const __m256i*)&values[i]);
+            value = _mm256_or_si256(_mm256_andnot_si256(mask, value), _mm256_and_si256(mask, maxValue));
+            min = _mm256_min_epi32(min, value);
+        }
+#else
+        auto maxValue = _mm_set1_epi32(INT_MAX);
+        for (int i = 0; i < count; i += 4) {
+            auto mask = _mm_loadu_si128((const __m128i*)&masks[i]);
+            auto value = _mm_loadu_si128((const __m128i*)&values[i]);
+            value = _mm_or_si128(_mm_andnot_si128(mask, value), _mm_and_si128(mask, maxValue));
+#if defined(__AVX__) || defined(__SSE4_1__)
+            min = _mm_min_epi32(min, value);
+#else
+            auto isSmaller = _mm_cmplt_epi32(value, min);
+            min = _mm_or_si128(_mm_and_si128(isSmaller, value), _mm_andnot_si128(isSmaller, min));
+#endif
+        }
+#endif
+    }
+    int get() const {
+        alignas(32) int32_t lanes[sizeof(min) / sizeof(int32_t)];
+#if defined(__AVX2__)
+        _mm256_store_si256((__m256i*)lanes, min);
+#else
+        _mm_store_si128((__m128i*)lanes, min);
+#endif
+        int result = lanes[0];
+        for (int i = 1; i < sizeof(min) / sizeof(int32_t); ++i) {
+            result = std::min(result, lanes[i]);
+        }
+        return result;
+    }
+};
+
+/*
+    Append only log read by a fixed set of readers, each with its own cursor.
+    size() counts everything that was ever pushed, but elements are only stored until
+    every registered reader has read past them, so memory stays bounded as long as
+    the readers keep up. With no readers nothing is kept.
+*/
+template<typename T> struct CursorLog {
+    std::deque<T> elements;
+    int firstStoredId = 0;
+    std::atomic<int> size_ = 0;
+    std::vector<int> readerCursors;
     std::mutex mutex;
 
-    ThreadSafeVec() {
-        init();
-    }
     int size() const {
         return size_;
     }
-    void push_back_not_thread_safe(const T& val) {
-        if (size_ == 0) {
-            (*blocks[0])[0] = val;
-            size_ += 1;
-            return;
-        }
-        int bitPos = int(mostSignificantBitPosition(size_));
-        int blockId = std::max(0, bitPos - smallestPower2 + 1);
-        if (blockId >= blocks.size()) {
-            while (blockId >= blocks.size()) {
-                blocks.emplace_back(std::make_unique<std::vector<T>>(totalCapacity));
-                totalCapacity *= 2;
-            }
-        }
-        int posInBlock = (blockId == 0) ? size_ : (size_ - (1 << bitPos));
-        (*blocks[blockId])[posInBlock] = val;
-        size_ += 1;
+    int addReader() {
+        std::scoped_lock l{ mutex };
+        readerCursors.push_back(firstStoredId);
+        return int(readerCursors.size()) - 1;
     }
-    void push_back(const T& val) {
+    void push_back(T val) {
         std::scoped_lock l{ mutex };
-        push_back_not_thread_safe(val);
+        elements.push_back(std::move(val));
+        size_ += 1;
+        dropElementsReadByAll();
     }
-    const T& operator[](int i) const {
-        if (i == 0)
-            return (*blocks[0])[0];
-        int bitPos = int(mostSignificantBitPosition(i));
-        int blockId = std::max(0, bitPos - smallestPower2 + 1);
-        int posInBlock = (blockId == 0) ? i : (i - (1 << bitPos));
-        return (*blocks[blockId])[posInBlock];
+    // calls func for every element given reader didn't see yet (outside of the lock)
+    template<typename F> void readNew(int readerId, F&& func) {
+        std::vector<T> newElements;
+        {
+            std::scoped_lock l{ mutex };
+            auto& cursor = readerCursors[readerId];
+            for (; cursor < size_; ++cursor) {
+                newElements.push_back(elements[cursor - firstStoredId]);
+            }
+            dropElementsReadByAll();
+        }
+        for (auto& element : newElements) {
+            func(element);
+        }
     }
     void clear() {
-        blocks.clear();
-        init();
+        std::scoped_lock l{ mutex };
+        elements.clear();
+        firstStoredId = 0;
+        size_ = 0;
+        std::fill(readerCursors.begin(), readerCursors.end(), 0);
     }
 private:
-    void init() {
-        totalCapacity = 1 << smallestPower2;
-        size_ = 0;
-        blocks.emplace_back(std::make_unique<std::vector<T>>(totalCapacity));
+    void dropElementsReadByAll() {
+        int minCursor = size_;
+        for (auto cursor : readerCursors)
+            minCursor = std::min(minCursor, cursor);
+        while (firstStoredId < minCursor) {
+            elements.pop_front();
+            firstStoredId += 1;
+        }
     }
 };
 
@@ -487,7 +624,7 @@ template<typename T> struct Vector3d {
 
 template<typename T, int MaxSize> struct FastSmallVector {
     std::array<T, MaxSize> data;
-    int size_ = 0;
+    std::conditional_t<(MaxSize < 256), uint8_t, int> size_ = 0; // small size type keeps SolutionEdge and RepeatNodeMatrix entries compact
     FastSmallVector() {}
     int size() const { return size_; }
     bool empty() const { return size() == 0; }
@@ -595,113 +732,120 @@ namespace std {
     };
 }
 
-template<typename T> class FastThreadSafeishHashSet {
-    struct Node {
-        Node(const T& value) { new (&value_) T(value); }
-        ~Node() { value().~T(); }
-        Node(const Node&) = delete;
-        Node& operator=(const Node&) = delete;
-        T& value() { return *(T*)value_; }
-        Node* next = nullptr;
-    private:
-        alignas(T) char value_[sizeof(T)];
-    };
-    
-    Node** data;
-    int capacity_;
-    int maxElementCount;
-    PoolAllocator allocator;
-    std::atomic<int> elementCount = 0;
-
-    Node*& node(std::size_t index) { return data[index]; }
-    int capacity() { return capacity_; }
+/*
+    Lock-free set of 64 bit fingerprints using open addressing with CAS insertion.
+    Memory is fixed at construction - when all slots a fingerprint can go into are taken
+    one of them gets overwritten, so the set forgets some old entries instead of growing.
+*/
+class FingerprintSet {
+    static constexpr int ProbeLength = 16;
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+    std::size_t mask;
 
-    Node** allocData(int size) {
-        auto x = (Node**)::operator new(size * sizeof(Node*), std::align_val_t(alignof(Node*)));
-        memset(x, 0, size * sizeof(Node*));
-        return x;
+    static uint64_t nonZero(uint64_t fingerprint) {
+        return fingerprint ? fingerprint : 1;
     }
-    void deallocData(Node** data) {
-        ::operator delete(data, capacity_ * sizeof(Node*), std::align_val_t(alignof(Node*)));
-    }
-    Node* allocNode(T&& value) {
-        auto node = (Node*)allocator.allocate();
-        new (node) Node(std::move(value));
-        return node;
-    }
-    Node* allocNode(const T& value) {
-        allocNode(T(value));
-    }
-    void deallocNode(Node* node) {
-        node->~Node();
-        allocator.deallocate(node);
+
+public:
+    FingerprintSet(int power2Capacity) : slots(new std::atomic<uint64_t>[std::size_t(1) << power2Capacity]()), mask((std::size_t(1) << power2Capacity) - 1) {}
+
+    bool contains(uint64_t fingerprint) const {
+        fingerprint = nonZero(fingerprint);
+        for (int i = 0; i < ProbeLength; ++i) {
+            auto value = slots[(fingerprint + i) & mask].load(std::memory_order_relaxed);
+            if (value == fingerprint)
+                return true;
+            if (value == 0)
+                return false;
+        }
+        return false;
     }
-    std::size_t hash(const T& value) {
-        return std::hash<T>{}(value);
+    /* returns false if fingerprint was already in the set */
+    bool insert(uint64_t fingerprint) {
+        fingerprint = nonZero(fingerprint);
+        for (int i = 0; i < ProbeLength; ++i) {
+            auto& slot = slots[(fingerprint + i) & mask];
+            uint64_t expected = slot.load(std::memory_order_relaxed);
+            if (expected == 0 && slot.compare_exchange_strong(expected, fingerprint, std::memory_order_relaxed))
+                return true;
+            if (expected == fingerprint)
+                return false;
+        }
+        slots[(fingerprint + (fingerprint >> 32) % ProbeLength) & mask].store(fingerprint, std::memory_order_relaxed);
+        return true;
     }
-    std::size_t modIndex(std::size_t index) {
-        return index & (capacity_ - 1);
+};
+
+/*
+    Thread safe map from 64 bit key to up to K smallest distinct costs inserted with that key.
+    Memory is fixed at construction - key goes into one of BucketSize entries of its bucket and when all of them
+    are taken the entry holding the fewest costs gets overwritten. Forgetting costs only makes insert
+    return true more often, so it's safe to use for pruning.
+    Keys, cost counts and costs of a bucket are stored next to each other, so that lookup touches as few cache lines as possible.
+*/
+class KBestCostTable {
+    static constexpr int BucketSize = 4;
+    static constexpr int LockCount = 4096;
+    int k;
+    std::size_t mask;
+    std::size_t bucketWords;
+    std::unique_ptr<uint64_t[]> buckets;
+    std::unique_ptr<std::mutex[]> locks;
+
+    static uint64_t nonZero(uint64_t key) {
+        return key ? key : 1;
     }
-    std::size_t getIndex(const T& value) {
-        return modIndex(hash(value));
+
+    static std::size_t BucketWords(int k) {
+        return BucketSize + (BucketSize + BucketSize * std::size_t(k) + 1) / 2;
     }
 
 public:
-    FastThreadSafeishHashSet(int maxElementCount, int power2Capacity) : allocator(sizeof(Node), 8192), data(allocData(1 << power2Capacity)), capacity_(1 << power2Capacity), maxElementCount(maxElementCount) {}
-    ~FastThreadSafeishHashSet() {
-        std::size_t index = 0;
-        while (!node(index))
-            index += 1;
-        while (true) {
-            Node* n = node(index);
-            while (n) {
-                auto nextNode = n->next;
-                deallocNode(n);
-                n = nextNode;
-            }
-            index += 1;
-            if (index >= capacity())
-                break;
-        }
-        deallocData(data);
+    static std::size_t MemoryPerKey(int k) {
+        return BucketWords(k) * sizeof(uint64_t) / BucketSize;
     }
 
-    bool hitElementLimit() {
-        return elementCount > maxElementCount;
+    KBestCostTable(int k, std::size_t maxMemory) : k(k), locks(new std::mutex[LockCount]) {
+        bucketWords = BucketWords(k);
+        std::size_t bucketCount = 1;
+        while (bucketCount * 2 * bucketWords * sizeof(uint64_t) <= maxMemory)
+            bucketCount *= 2;
+        mask = bucketCount - 1;
+        buckets.reset(new uint64_t[bucketCount * bucketWords]());
     }
 
-    T* find(const T& value) {
-        Node* n = node(getIndex(value));
-        while (n) {
-            if (n->value() == value)
-                return &n->value();
-            n = n->next;
+    /* returns false if k distinct costs smaller than cost were already inserted with that key */
+    bool insert(uint64_t key, int cost) {
+        key = nonZero(key);
+        auto bucket = key & mask;
+        std::scoped_lock l{ locks[bucket % LockCount] };
+        auto keys = &buckets[bucket * bucketWords];
+        auto costCounts = (int*)(keys + BucketSize);
+        auto entry = 0;
+        for (int i = 0; i < BucketSize; ++i) {
+            if (keys[i] == key) {
+                entry = i;
+                break;
+            }
+            if (costCounts[i] < costCounts[entry])
+                entry = i;
         }
-        return nullptr;
-    }
-    void emplace(T&& value) {
-        // This is not thread safe, but good enough in practice.
-        // worst case what happens is I will add into same location twice which will result in orphan node which won't be findable,
-        // or it will add duplicate of the same node.
-        // however niether is a big problem, because orphan pointers are going to get deallocated anyway and having some duplicates
-        // is not a problem.
-        if (hitElementLimit())
-            return;
-        elementCount += 1;
-        auto i = getIndex(value);
-        auto n = node(i);
-        Node* allocatedNode = allocNode(std::move(value));
-        if (!n) {
-            node(i) = allocatedNode;
-            return;
+        if (keys[entry] != key) {
+            keys[entry] = key;
+            costCounts[entry] = 0;
         }
-        while (n->next) {
-            n = n->next;
-        };
-        n->next = allocatedNode;
-    }
-    void insert(T value) {
-        emplace(std::move(value));
+        auto& count = costCounts[entry];
+        auto entryCosts = costCounts + BucketSize + entry * k;
+        if (count == k && entryCosts[k - 1] < cost)
+            return false;
+        auto it = std::lower_bound(entryCosts, entryCosts + count, cost);
+        if (it != entryCosts + count && *it == cost)
+            return true;
+        if (count < k)
+            count += 1;
+        std::copy_backward(it, entryCosts + count - 1, entryCosts + count);
+        *it = cost;
+        return true;
     }
 };
 